@@ -3,13 +3,20 @@
 //
 
 #include <CGAL/Surface_mesh_approximation/approximate_triangle_mesh.h>
+#include <CGAL/Variational_shape_approximation.h>
+#include <CGAL/Random.h>
  
 #include <CGAL/Polygon_mesh_processing/orient_polygon_soup.h>
-#include <CGAL/Polygon_mesh_processing/polygon_soup_to_polygon_mesh.h>
 #include <CGAL/Polygon_mesh_processing/orientation.h>
 
+#include <chrono>
+#include <numeric>
+
 #include "approximate.hpp"
 #include "triangulate.hpp"
+#include "partgraph.hpp"
+#include "cache.hpp"
+#include "repair.hpp"
 
 //
 // Mesh Approximation class.
@@ -22,85 +29,96 @@ typedef boost::property_map<Surface_mesh, boost::vertex_point_t>::type Vertex_po
 namespace VSA = CGAL::Surface_mesh_approximation;
 namespace PMP = CGAL::Polygon_mesh_processing;
 
-static std::vector<std::array<float,3>> g_proxy_color;
-
-static void UpdateProxyColors(size_t proxy_count)
+//
+// Color of a proxy hashed from the proxy index, so a proxy has the same color in every run.
+//
+static void ProxyColor(unsigned proxy, float color[3])
 {
-    static std::mt19937 rng(static_cast<unsigned>(std::time(nullptr)));
-    static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-
-    if (g_proxy_color.size() < proxy_count)
-    {
-        g_proxy_color.reserve(proxy_count);
-        while (g_proxy_color.size() < proxy_count) {
-            std::array<float,3> color = { dist(rng), dist(rng), dist(rng) };
-            g_proxy_color.push_back(color);
-        }
-    }
+    uint64_t key = MeshUtil::Mix64(static_cast<uint64_t>(proxy) + 1);
+    for (auto i = 0u; i < 3; i++)
+        color[i] = static_cast<float>((key >> (i * 21)) & 0x1fffff) / static_cast<float>(0x1fffff);
 }
 
 //
-// Convert the internal CApproximate mesh representation to a CGAL Surface_mesh.
+// Seed of a part derived from the user seed and the fingerprint of the part, so an unchanged
+// part gets the same seed wherever it is in the mesh.
 //
-static void ConvertToCGALMesh(Surface_mesh& out_mesh, std::map<Surface_mesh::Edge_index, bool>& constrained_edges, CApproximate* context)
+static unsigned PartSeed(int seed, uint64_t fingerprint)
 {
-    CMesh& cmesh = context->m_cmesh;
+    return static_cast<unsigned>(MeshUtil::Mix64(static_cast<uint64_t>(seed) ^ MeshUtil::Mix64(fingerprint)));
+}
 
-    std::unordered_map<CVerxID, Surface_mesh::Vertex_index> vertex_map;
+//
+// Counts of the triangles which could not be converted to a CGAL Surface_mesh.
+//
+struct CConvertStats
+{
+    unsigned missing = 0;   // triangles referencing a vertex out of the part
+    unsigned failed  = 0;   // triangles rejected by add_face (non-manifold)
 
-    for (auto& v : cmesh.m_vertices)
+    void Print() const
     {
-        Point_3 p(v->pos[0], v->pos[1], v->pos[2]);
-        Surface_mesh::Vertex_index vi = out_mesh.add_vertex(p);
-        vertex_map[v] = vi;
+        if (missing || failed)
+            std::cerr << "warning: " << missing << " triangles reference missing vertices, add_face failed for " << failed << " triangles\n";
     }
+};
 
-    for (auto& tri : cmesh.m_triangles)
-    {
-        Surface_mesh::Vertex_index v0 = vertex_map[tri->v0];
-        Surface_mesh::Vertex_index v1 = vertex_map[tri->v1];
-        Surface_mesh::Vertex_index v2 = vertex_map[tri->v2];
-        auto f = out_mesh.add_face(v0, v1, v2);
-        if (f == Surface_mesh::null_face()) {
-            std::cerr << "warning: add_face failed for vertices\n";
-            continue;
-        }
-    }
+//
+// Convert the part to a CGAL Surface_mesh. The point type of the Surface_mesh follows the kernel
+// of the VSA path. The part vertices are listed in CMesh vertex order, so the local index of a
+// vertex is a binary search over their indices.
+//
+template <typename Mesh>
+static void ConvertToCGALMesh(Mesh& out_mesh, CPartID part, CConvertStats& stats)
+{
+    typedef typename Mesh::Point     Point;
+    typedef typename Mesh::size_type size_type;
 
-    CLxUser_Edge    uedge;
-    uedge.fromMesh(context->m_mesh);
+    // every edge is counted at both of its vertices.
+    size_t nedge = 0;
+    for (auto& v : part->vrts)
+        nedge += v->edge.size();
 
-    CLxUser_Polygon upoly0, upoly1;
-    upoly0.fromMesh(context->m_mesh);
-    upoly1.fromMesh(context->m_mesh);
-}
+    out_mesh.reserve(static_cast<size_type>(part->vrts.size()),
+                     static_cast<size_type>(nedge / 2),
+                     static_cast<size_type>(part->tris.size()));
 
-static void ConvertToCGALMesh(Surface_mesh& out_mesh, CPartID part)
-{
-    std::unordered_map<CVerxID, Surface_mesh::Vertex_index> vertex_map;
-    vertex_map.reserve(part->vrts.size());
+    if (part->vrts.empty())
+        return;
 
-    for (auto& v : part->vrts)
+    auto nvrt = part->vrts.size();
+    std::vector<unsigned> global(nvrt);
+    std::vector<typename Mesh::Vertex_index> vertex_map(nvrt);
+    for (auto i = 0u; i < nvrt; i++)
     {
-        Point_3 p(v->pos[0], v->pos[1], v->pos[2]);
-        Surface_mesh::Vertex_index vi = out_mesh.add_vertex(p);
-        vertex_map[v] = vi;
+        const CVerx& v = *part->vrts[i];
+        global[i]     = v.index;
+        vertex_map[i] = out_mesh.add_vertex(Point(v.pos[0], v.pos[1], v.pos[2]));
     }
+    auto local = [&](const CVerxID& v) {
+        return vertex_map[std::lower_bound(global.begin(), global.end(), v->index) - global.begin()];
+    };
 
     for (auto& tri : part->tris)
     {
-        auto it0 = vertex_map.find(tri->v0);
-        auto it1 = vertex_map.find(tri->v1);
-        auto it2 = vertex_map.find(tri->v2);
-        if (it0 == vertex_map.end() || it1 == vertex_map.end() || it2 == vertex_map.end()) {
-            std::cerr << "warning: triangle references missing vertex\n";
-            continue;
-        }
-        auto f = out_mesh.add_face(it0->second, it1->second, it2->second);
-        if (f == Surface_mesh::null_face()) {
-            std::cerr << "warning: add_face failed\n";
+        if (tri->v0->part != part->index || tri->v1->part != part->index || tri->v2->part != part->index)
+        {
+            stats.missing ++;
             continue;
         }
+        auto f = out_mesh.add_face(local(tri->v0), local(tri->v1), local(tri->v2));
+        if (f == Mesh::null_face())
+            stats.failed ++;
+    }
+}
+
+static const char* KernelName(int kernel)
+{
+    switch (kernel)
+    {
+        case CApproximate::CARTESIAN:       return "Simple_cartesian<double>";
+        case CApproximate::CARTESIAN_FLOAT: return "Simple_cartesian<float>";
+        default:                            return "Epick";
     }
 }
 
@@ -132,37 +150,22 @@ static void PrintCGALMesh(Surface_mesh& mesh)
     }
 }
 
-static void ConvertFromCGALMesh(Surface_mesh& surface_mesh, CLxUser_Mesh& mesh)
+//
+// Signed volume of a triangle soup. It is positive when a closed soup is oriented outward.
+//
+static double SoupVolume(const std::vector<Point_3>& points, const std::vector<CSoupTriangle>& triangles)
 {
-    CLxUser_Polygon     poly;
-    CLxUser_Point       vert;
-
-    poly.fromMesh(mesh);
-    vert.fromMesh(mesh);
-
-    std::unordered_map<Surface_mesh::Vertex_index, LXtPointID> v_to_point;
-    v_to_point.reserve(surface_mesh.number_of_vertices());
-
-    for (auto v : surface_mesh.vertices())
+    double volume = 0.0;
+    for (auto& tri : triangles)
     {
-        Point_3 p = surface_mesh.point(v);
-        LXtPointID new_vrt;
-        LXtVector pos;
-        LXx_VSET3(pos, p.x(), p.y(), p.z());
-        vert.New(pos, &new_vrt);
-        v_to_point[v] = new_vrt;
-    }
-
-    for (auto f : surface_mesh.faces())
-    {
-        std::vector<LXtPointID> tri;
-        for (auto v : CGAL::vertices_around_face(surface_mesh.halfedge(f), surface_mesh))
-        {
-            tri.push_back(v_to_point[v]);
-        }
-        LXtPolygonID new_pol;
-        poly.New(LXiPTYP_FACE, tri.data(), tri.size(), 0, &new_pol);
+        const Point_3& a = points[tri[0]];
+        const Point_3& b = points[tri[1]];
+        const Point_3& c = points[tri[2]];
+        volume += a.x() * (b.y() * c.z() - b.z() * c.y()) +
+                  a.y() * (b.z() * c.x() - b.x() * c.z()) +
+                  a.z() * (b.x() * c.y() - b.y() * c.x());
     }
+    return volume;
 }
 
 // Build internal mesh representation
@@ -173,81 +176,372 @@ LxResult CApproximate::BuildMesh(CLxUser_Mesh& base_mesh)
     m_poly.fromMesh(m_mesh);
     m_vert.fromMesh(m_mesh);
     m_vmap.fromMesh(m_mesh);
-    return m_cmesh.BuildMesh(base_mesh);
+    m_cmesh.m_debug = m_debug;
+    return m_cmesh.BuildMesh(base_mesh, CThreadPool::Shared(static_cast<unsigned>(std::max(m_threads, 0))));
 }
 
+//
+// Take the snapshot of the source mesh. The SDK is called only here, so this runs on the main
+// thread and Compute() can run on any thread.
+//
+LxResult CApproximate::Snapshot(CLxUser_Mesh& base_mesh)
+{
+    m_mesh.set(base_mesh);
+    m_built = false;
+    m_live.clear();
+    LxResult result = m_cmesh.Snapshot(base_mesh);
+    m_snapshot_hash = m_cmesh.m_snapshot.Hash();
+    return result;
+}
 
 //
-// Variational Shape Approximation
+// Return true if the live parts can be refined for the settings of the other context. The other
+// context took the snapshot of the same mesh, and the seeding of the proxies is the same. The
+// number of iterations is checked per part, since a part runs only the extra iterations.
 //
-LxResult CApproximate::ApproximatePart(CLxUser_Mesh& base_mesh, CPartID part)
+bool CApproximate::CanRefine(const CApproximate& other) const
 {
-    std::cout << "*** part: " << part->index << " tris : " << part->tris.size() << " vrts : " << part->vrts.size() << std::endl;
+    return m_keep_live && m_built &&
+           (m_snapshot_hash == other.m_snapshot_hash) &&
+           (m_kernel == other.m_kernel) &&
+           (m_seed == other.m_seed);
+}
 
-    Surface_mesh surface_mesh;
-    ConvertToCGALMesh(surface_mesh, part);
-    //PrintCGALMesh(surface_mesh);
+//
+// Return true if the segmentation of the live parts can be repaired for the other context. The
+// other context took the snapshot of the edited mesh with the same settings, and every part of
+// the live context was segmented.
+//
+bool CApproximate::CanRepair(const CApproximate& other) const
+{
+    return m_keep_live && m_built &&
+           (m_mode == Mode::SEGMENTATION) && (other.m_mode == Mode::SEGMENTATION) &&
+           (m_proxies == other.m_proxies) &&
+           (m_iteration == other.m_iteration) &&
+           (m_kernel == other.m_kernel) &&
+           (m_seed == other.m_seed) &&
+           (m_proxy_sources.size() == m_cmesh.m_parts.size());
+}
 
-    auto fpxmap = surface_mesh.add_property_map<face_descriptor, cluster_id_t>("f:proxy_id", 0).first;
+//
+// Key of the given hash for the settings computing the parts. The write-back settings are not
+// in the key, since the write-back runs again from the kept outputs.
+//
+uint64_t CApproximate::SettingsKey(uint64_t hash) const
+{
+    uint64_t key = hash;
+    key = MeshUtil::Mix64(key ^ static_cast<uint64_t>(m_mode));
+    key = MeshUtil::Mix64(key ^ static_cast<uint64_t>(m_proxies));
+    key = MeshUtil::Mix64(key ^ static_cast<uint64_t>(m_iteration));
+    key = MeshUtil::Mix64(key ^ static_cast<uint64_t>(m_kernel));
+    key = MeshUtil::Mix64(key ^ static_cast<uint64_t>(static_cast<uint32_t>(m_seed)));
+    return key;
+}
 
-    // The output will be an indexed triangle mesh
-    std::vector<Point_3> anchors;
-    std::vector<std::array<std::size_t, 3> > triangles;
+//
+// Key of the result of the snapshot.
+//
+uint64_t CApproximate::ResultKey() const
+{
+    return SettingsKey(m_snapshot_hash);
+}
 
-    std::cout << "is_valid: " << CGAL::is_valid(surface_mesh) << std::endl;
-    PMP::orient_to_bound_a_volume(surface_mesh);
+//
+// Key of the output of a part. The part index is not in the key, so the output of a part is
+// reused when the parts before it are edited.
+//
+uint64_t CApproximate::PartKey(CPartID part) const
+{
+    return SettingsKey(MeshUtil::Mix64(part->fingerprint) + 1);
+}
 
-    // free function interface with named parameters
-    if (m_mode == CApproximate::APPROXIMATION)
+//
+// Give the kept output of an unchanged part. The live parts are refined instead.
+//
+bool CApproximate::RestorePart(CPartID part, CPartOutput& output)
+{
+    if (!m_part_cache || (m_keep_live && m_live[part->index]))
+        return false;
+    auto kept = m_part_cache->Find(PartKey(part));
+    if (!kept || kept->size() != 1)
+        return false;
+    return (*kept)[0].Restore(part, output, m_debug);
+}
+
+void CApproximate::KeepPart(CPartID part, const CPartOutput& output)
+{
+    if (!m_part_cache)
+        return;
+    CResultCache::Result kept(1);
+    kept[0].Save(*this, part, output);
+    m_part_cache->Insert(PartKey(part), std::move(kept));
+}
+
+void CApproximate::CopySettings(const CApproximate& other)
+{
+    // the other context took the snapshot of the same hash from a new copy of the mesh.
+    m_mesh.set(other.m_mesh);
+    m_cmesh.Rebind(other.m_cmesh);
+    m_mode = other.m_mode;
+    m_proxies = other.m_proxies;
+    m_iteration = other.m_iteration;
+    m_segment = other.m_segment;
+    m_new_mesh = other.m_new_mesh;
+    m_set_color = other.m_set_color;
+    m_sset = other.m_sset;
+    m_kernel = other.m_kernel;
+    m_debug = other.m_debug;
+    m_threads = other.m_threads;
+    m_seed = other.m_seed;
+    m_part_cache = other.m_part_cache;
+}
+
+//
+// Relaxations after proxies are added to or merged in a live part.
+//
+static const std::size_t REFINE_ITERATIONS = 3;
+
+//
+// Outputs kept per live part.
+//
+static const std::size_t PART_SNAPSHOTS = 8;
+
+//
+// Make the proxy sources of the part from the proxies of its triangles.
+//
+static void ProxySources(CPartID part, CPartOutput& output, int debug)
+{
+    unsigned proxy_count = 0;
+    for (auto tri : part->tris)
+    {
+        if (tri->proxy > proxy_count)
+            proxy_count = tri->proxy;
+    }
+    std::vector<CTriangleID>& proxy_source = output.proxy_source;
+    proxy_count ++;
+    proxy_source.resize(proxy_count);
+    for (auto tri : part->tris)
+    {
+        proxy_source[tri->proxy] = tri;
+    }
+    if (debug)
+        printf("proxy_count : %u\n", proxy_count);
+}
+
+//
+// Repair the segmentation of the part with the same triangles in the last segmentation. Only the
+// proxies around the moved triangles are fitted and flooded again. The VSA cannot start from a
+// given partition, so a repaired part has no live part, and a new Max of Proxies or a larger
+// Iteration seeds it again.
+//
+bool CApproximate::RepairPart(CPartID part, CPartOutput& output)
+{
+    if (!m_repair_source || m_mode != Mode::SEGMENTATION)
+        return false;
+    auto& sources = m_repair_source->m_cmesh.m_parts;
+    if (part->index >= sources.size())
+        return false;
+    CPartID source = sources[part->index];
+    if (source->topology != part->topology)
+        return false;
+
+    auto start = std::chrono::steady_clock::now();
+    CPartRepair repair(m_cmesh);
+    if (!repair.Run(*part, *source, static_cast<unsigned>(REFINE_ITERATIONS)))
+        return false;
+    ProxySources(part, output, m_debug);
+
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (m_debug)
+        printf("*** part: %u repaired moved: %u region: %u of %zu time: %.1f ms\n", part->index, repair.NumMoved(), repair.NumRegion(), part->tris.size(), elapsed);
+    return output.result == LXe_OK;
+}
+
+//
+// Return true if the snapshot is the output for the settings of the context.
+//
+bool CPartSnapshot::Matches(const CApproximate& context) const
+{
+    return (proxies == context.m_proxies) && (iteration == context.m_iteration) && (mode == context.m_mode);
+}
+
+//
+// Keep the output of the part for the settings of the context.
+//
+void CPartSnapshot::Save(const CApproximate& context, CPartID part, const CPartOutput& output)
+{
+    proxies   = context.m_proxies;
+    iteration = context.m_iteration;
+    mode      = context.m_mode;
+    if (mode == CApproximate::SEGMENTATION)
     {
-        bool is_manifold = VSA::approximate_triangle_mesh(surface_mesh,
-                    CGAL::parameters::verbose_level(VSA::MAIN_STEPS).
-                                    max_number_of_proxies(m_proxies).
-                                    number_of_iterations(m_iteration). // number of relaxation iterations after 
-                                    anchors(std::back_inserter(anchors)). // anchor points
-                                    triangles(std::back_inserter(triangles))); // indexed triangles
+        tri_proxy.resize(part->tris.size());
+        for (auto i = 0u; i < part->tris.size(); i++)
+            tri_proxy[i] = part->tris[i]->proxy;
+    }
+    else
+    {
+        points    = output.points;
+        triangles = output.triangles;
+    }
+}
+
+//
+// Give the kept output of the part. Return false if it does not fit the part.
+//
+bool CPartSnapshot::Restore(CPartID part, CPartOutput& output, int debug) const
+{
+    if (mode == CApproximate::SEGMENTATION)
+    {
+        if (tri_proxy.size() != part->tris.size())
+            return false;
+        for (auto i = 0u; i < part->tris.size(); i++)
+            part->tris[i]->proxy = tri_proxy[i];
+        ProxySources(part, output, debug);
+    }
+    else
+    {
+        output.points    = points;
+        output.triangles = triangles;
+    }
+    return true;
+}
+
+//
+// Give the output kept for the settings of the context, if any.
+//
+bool CLivePart::Restore(const CApproximate& context, CPartID part, CPartOutput& output) const
+{
+    for (auto& snapshot : m_snapshots)
+    {
+        if (snapshot.Matches(context))
+            return snapshot.Restore(part, output, context.m_debug);
+    }
+    return false;
+}
+
+//
+// Keep the output for the settings of the context. The oldest output is dropped first.
+//
+void CLivePart::Save(const CApproximate& context, CPartID part, const CPartOutput& output)
+{
+    for (auto it = m_snapshots.begin(); it != m_snapshots.end(); ++it)
+    {
+        if (it->Matches(context))
+        {
+            m_snapshots.erase(it);
+            break;
+        }
+    }
+    if (m_snapshots.size() >= PART_SNAPSHOTS)
+        m_snapshots.pop_front();
 
-        std::cout << "#is_manifold: " << is_manifold << std::endl;
-        std::cout << "#anchor points: " << anchors.size() << std::endl;
-        std::cout << "#triangles: " << triangles.size() << std::endl;
+    m_snapshots.emplace_back();
+    m_snapshots.back().Save(context, part, output);
+}
+
+//
+// Live approximation of a part on the given kernel. The triangle mesh is owned here, since the
+// metric and the approximation keep references to it.
+//
+template <typename K, typename TriangleMesh, typename VertexPointMap, typename FaceProxyMap>
+struct CLiveApproximation : public CLivePart
+{
+    typedef VSA::L21_metric_plane_proxy<TriangleMesh, VertexPointMap, K>                   Metric;
+    typedef CGAL::Variational_shape_approximation<TriangleMesh, VertexPointMap, Metric, K> Approximation;
 
-        // convert from soup to surface mesh
-        Surface_mesh output;
-        PMP::orient_polygon_soup(anchors, triangles);
-        PMP::polygon_soup_to_polygon_mesh(anchors, triangles, output);
-        if (CGAL::is_closed(output) && (!PMP::is_outward_oriented(output)))
-            PMP::reverse_face_orientations(output);
-        //PrintCGALMesh (output);
-        m_outputs.push_back(output);
+    std::unique_ptr<TriangleMesh> m_mesh;
+    Metric                        m_metric;
+    Approximation                 m_approx;
+    FaceProxyMap                  m_fpxmap;
+    std::vector<cluster_id_t>     m_face_proxy;     // storage of m_fpxmap on a part graph
+
+    CLiveApproximation(TriangleMesh* mesh, VertexPointMap vpmap)
+        : m_mesh(mesh), m_metric(*mesh, vpmap), m_approx(*mesh, vpmap, m_metric) {}
+
+    LxResult Update(CApproximate& context, CPartID part, CPartOutput& output) override;
+};
+
+//
+// Seed and run the part at the first update. The later updates add proxies at the triangles of
+// the largest errors or merge the adjacent proxies of the smallest merge error, and relax the
+// partition a few times. More iterations than the partition is relaxed for run the extra
+// iterations only. The output is made from the partition of the update.
+//
+template <typename K, typename TriangleMesh, typename VertexPointMap, typename FaceProxyMap>
+LxResult CLiveApproximation<K, TriangleMesh, VertexPointMap, FaceProxyMap>::Update(CApproximate& context, CPartID part, CPartOutput& output)
+{
+    std::size_t target = static_cast<std::size_t>(context.m_proxies);
+    std::size_t count  = m_approx.number_of_proxies();
+
+    if (count == 0)
+    {
+        m_approx.initialize_seeds(CGAL::parameters::seeding_method(VSA::HIERARCHICAL).
+                                                    max_number_of_proxies(target));
+        m_approx.run(static_cast<std::size_t>(context.m_iteration));
     }
-    else if (m_mode == CApproximate::SEGMENTATION)
+    else if (target > count)
     {
-        bool is_manifold = VSA::approximate_triangle_mesh(surface_mesh,
-                    CGAL::parameters::verbose_level(VSA::MAIN_STEPS).
-                                    max_number_of_proxies(m_proxies).
-                                    number_of_iterations(m_iteration). // number of relaxation iterations after 
-                                    face_proxy_map(fpxmap)); // indexed triangles
+        m_approx.add_to_furthest_proxies(target - count, REFINE_ITERATIONS);
+    }
+    else if (target < count)
+    {
+        while (m_approx.number_of_proxies() > target)
+        {
+            auto best = m_approx.find_best_merge(true);
+            if (!best)
+                break;
+            m_approx.merge(best->first, best->second);
+        }
+        m_approx.run(REFINE_ITERATIONS);
+    }
+    if (count > 0 && context.m_iteration > m_iteration)
+        m_approx.run(static_cast<std::size_t>(context.m_iteration - m_iteration));
+    m_iteration = context.m_iteration;
 
-        std::cout << "#is_manifold: " << is_manifold << std::endl;
+    if (context.m_debug)
+        printf("#proxies: %zu -> %zu iterations: %d\n", count, m_approx.number_of_proxies(), m_iteration);
 
-        unsigned proxy_count = 0;
-        for (auto f : surface_mesh.faces())
+    if (context.m_mode == CApproximate::APPROXIMATION)
+    {
+        // The output will be an indexed triangle mesh
+        std::vector<typename K::Point_3> anchors;
+        std::vector<CSoupTriangle> triangles;
+
+        bool is_manifold = m_approx.extract_mesh(CGAL::parameters::default_values());
+        m_approx.anchor_points(std::back_inserter(anchors));
+        m_approx.indexed_triangles(std::back_inserter(triangles));
+
+        if (context.m_debug)
+            printf("#is_manifold: %d #anchor points: %zu #triangles: %zu\n", is_manifold, anchors.size(), triangles.size());
+
+        // the output is always on the Epick kernel.
+        std::vector<Point_3>& points = output.points;
+        points.reserve(anchors.size());
+        for (auto& p : anchors)
+            points.emplace_back(p.x(), p.y(), p.z());
+        std::vector<typename K::Point_3>().swap(anchors);
+
+        // orient the soup, and turn it outward when the part bounds a volume.
+        PMP::orient_polygon_soup(points, triangles);
+        if (part->closed && is_manifold && SoupVolume(points, triangles) < 0.0)
         {
-            //std::cout << "face : " << f << " proxy : " << fpxmap[f] << std::endl;
-            part->tris[f]->proxy = fpxmap[f];
-            if (part->tris[f]->proxy > proxy_count)
-                proxy_count = part->tris[f]->proxy;
+            for (auto& tri : triangles)
+                std::swap(tri[1], tri[2]);
         }
-        std::vector<CTriangleID> proxy_source;
-        proxy_count ++;
-        proxy_source.resize(proxy_count);
-        for (auto tri : part->tris)
+
+        output.triangles.swap(triangles);
+    }
+    else if (context.m_mode == CApproximate::SEGMENTATION)
+    {
+        m_approx.proxy_map(m_fpxmap);
+
+        for (auto f : faces(*m_mesh))
         {
-            proxy_source[tri->proxy] = tri;
-            //std::cout << "tri : " << tri->index << " proxy : " << tri->proxy << std::endl;
+            auto& tri = part->tris[static_cast<std::size_t>(f)];
+            tri->proxy = static_cast<unsigned>(get(m_fpxmap, f));
         }
-        m_proxy_sources.push_back(proxy_source);
-        std::cout << "proxy_count : " << proxy_count << std::endl;
+        ProxySources(part, output, context.m_debug);
     }
     else
     {
@@ -258,79 +552,416 @@ LxResult CApproximate::ApproximatePart(CLxUser_Mesh& base_mesh, CPartID part)
 }
 
 //
-// Variational Shape Approximation
+// Variational Shape Approximation of a part. This runs on a worker thread and touches only the
+// part, its live approximation and its output.
 //
-LxResult CApproximate::ApproximateMesh(CLxUser_Mesh& base_mesh)
+LxResult CApproximate::ApproximatePart(CPartID part, CPartOutput& output)
 {
-    BuildMesh(base_mesh);
+    auto start = std::chrono::steady_clock::now();
+
+    // Fewer iterations than the live part is relaxed for are taken from its snapshots, or the
+    // part is seeded again.
+    LxResult   result;
+    CLivePart* live = m_keep_live ? m_live[part->index].get() : nullptr;
+    bool       restored = live && live->Restore(*this, part, output);
+    if (restored)
+    {
+        result = LXe_OK;
+    }
+    else if (live && m_iteration >= live->m_iteration)
+    {
+        result = live->Update(*this, part, output);
+    }
+    else
+    {
+        std::deque<CPartSnapshot> snapshots;
+        if (live)
+            snapshots.swap(live->m_snapshots);
+
+        // The VSA draws the seed triangles of the proxies from the default random of CGAL, which
+        // is thread local. Seeding it here makes the part independent of the thread running it.
+        if (m_seed >= 0)
+            CGAL::get_default_random() = CGAL::Random(PartSeed(m_seed, part->fingerprint));
+        else
+            CGAL::get_default_random() = CGAL::Random(std::random_device()());
 
-    m_proxy_sources.clear();
-    m_outputs.clear();
+        if (m_kernel == KernelType::CARTESIAN)
+            result = ApproximatePartWith<Cartesian_kernel>(part, output);
+        else if (m_kernel == KernelType::CARTESIAN_FLOAT)
+            result = ApproximatePartWith<Cartesian_float_kernel>(part, output);
+        else
+            result = ApproximatePartWith<Kernel>(part, output);
+
+        if (m_keep_live && m_live[part->index])
+            m_live[part->index]->m_snapshots.swap(snapshots);
 
-    for (auto part : m_cmesh.m_parts)
+        // compare the kernels on a copy of the part from the same seed.
+        if (m_debug && result == LXe_OK)
+        {
+            unsigned seed = PartSeed(std::max(m_seed, 0), part->fingerprint);
+            double   error[3], ms[3];
+            ms[EPICK]           = MeasureKernel<Kernel>(part, seed, error[EPICK]);
+            ms[CARTESIAN]       = MeasureKernel<Cartesian_kernel>(part, seed, error[CARTESIAN]);
+            ms[CARTESIAN_FLOAT] = MeasureKernel<Cartesian_float_kernel>(part, seed, error[CARTESIAN_FLOAT]);
+            printf("kernels: part %u %s %.1f ms error %g %s %.1f ms error %g %s %.1f ms error %g\n", part->index,
+                   KernelName(EPICK), ms[EPICK], error[EPICK],
+                   KernelName(CARTESIAN), ms[CARTESIAN], error[CARTESIAN],
+                   KernelName(CARTESIAN_FLOAT), ms[CARTESIAN_FLOAT], error[CARTESIAN_FLOAT]);
+        }
+    }
+    if (!restored && result == LXe_OK && m_keep_live && m_live[part->index])
+        m_live[part->index]->Save(*this, part, output);
+
+    // one printf per part, so the lines of parallel parts do not mix.
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (m_debug)
+        printf("*** part: %u tris : %zu vrts : %zu kernel: %s time: %.1f ms\n", part->index, part->tris.size(), part->vrts.size(), KernelName(m_kernel), elapsed);
+    return result;
+}
+
+//
+// Run the part on the given kernel. The kernel sets the point type of the Surface_mesh copy
+// and the geometric traits of the VSA. The live approximation is kept for the next evaluation
+// when m_keep_live is set.
+//
+template <typename K>
+LxResult CApproximate::ApproximatePartWith(CPartID part, CPartOutput& output)
+{
+    typedef typename K::Point_3                                  Point;
+    typedef CGAL::Surface_mesh<Point>                            Mesh;
+    typedef typename Mesh::template Property_map<typename Mesh::Face_index, cluster_id_t> Mesh_proxy_map;
+
+    std::unique_ptr<CLivePart> live;
+
+    // Run on the part directly when it is a manifold, consistently oriented triangle mesh.
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<CPartGraph> graph(new CPartGraph);
+    if (part->manifold && part->oriented && graph->Build(*part) == LXe_OK)
     {
-        auto result = ApproximatePart(base_mesh, part);
-        if (result != LXe_OK)
-            continue;
+        // compare the halfedge arrays with the Surface_mesh copy they replace.
+        if (m_debug)
+        {
+            auto graph_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            start = std::chrono::steady_clock::now();
+            Mesh copy;
+            CConvertStats stats;
+            ConvertToCGALMesh(copy, part, stats);
+            auto copy_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            printf("part graph: %u vrts %u edges %zu bytes %.2f ms Surface_mesh copy: %.2f ms\n", graph->NumVertices(), graph->NumEdges(), graph->MemoryUsage(), graph_ms, copy_ms);
+        }
+        typedef CLiveApproximation<K, CPartGraph, CPartPointMap<Point>, CPartFaceMap<cluster_id_t>> Live;
+        CPartPointMap<Point> vpmap(graph.get());
+        auto nfaces = graph->NumFaces();
+        Live* approx = new Live(graph.release(), vpmap);
+        approx->m_face_proxy.assign(nfaces, 0);
+        approx->m_fpxmap = CPartFaceMap<cluster_id_t>(&approx->m_face_proxy);
+        live.reset(approx);
+    }
+    else
+    {
+        graph.reset();
+
+        // Otherwise copy it into a Surface_mesh, which skips the faces it cannot add.
+        std::unique_ptr<Mesh> surface_mesh(new Mesh);
+        CConvertStats stats;
+        ConvertToCGALMesh(*surface_mesh, part, stats);
+        stats.Print();
+
+        if (m_debug)
+            printf("closed: %d manifold: %d oriented: %d is_valid: %d\n", part->closed, part->manifold, part->oriented, CGAL::is_valid(*surface_mesh));
+
+        // The part flags are taken from the edges at CMesh build, so only closed parts with
+        // flipped triangles are reoriented.
+        if (part->closed && !part->oriented)
+            PMP::orient_to_bound_a_volume(*surface_mesh);
+
+        typedef CLiveApproximation<K, Mesh, typename boost::property_map<Mesh, boost::vertex_point_t>::type, Mesh_proxy_map> Live;
+        auto vpmap  = get(CGAL::vertex_point, *surface_mesh);
+        auto fpxmap = surface_mesh->template add_property_map<typename Mesh::Face_index, cluster_id_t>("f:proxy_id", 0).first;
+        Live* approx = new Live(surface_mesh.release(), vpmap);
+        approx->m_fpxmap = fpxmap;
+        live.reset(approx);
     }
 
-    return LXe_OK;
+    LxResult result = live->Update(*this, part, output);
+    if (m_keep_live)
+        m_live[part->index] = std::move(live);
+    return result;
 }
 
 //
-// Write the approximation output to the given mesh.
+// Run the part on the given kernel from the seed on a Surface_mesh copy, and give the time
+// taken in ms and the total fitting error of the partition. This compares the kernels with
+// Debug, and keeps the default random of the thread as it was.
 //
-LxResult CApproximate::WriteApproximation(CLxUser_Mesh& edit_mesh)
+template <typename K>
+double CApproximate::MeasureKernel(CPartID part, unsigned seed, double& error) const
 {
-    for (auto& output : m_outputs)
+    typedef typename K::Point_3                                                    Point;
+    typedef CGAL::Surface_mesh<Point>                                              Mesh;
+    typedef typename boost::property_map<Mesh, boost::vertex_point_t>::type       VertexPointMap;
+    typedef VSA::L21_metric_plane_proxy<Mesh, VertexPointMap, K>                   Metric;
+    typedef CGAL::Variational_shape_approximation<Mesh, VertexPointMap, Metric, K> Approximation;
+
+    CGAL::Random random = CGAL::get_default_random();
+    auto start = std::chrono::steady_clock::now();
+
+    Mesh mesh;
+    CConvertStats stats;
+    ConvertToCGALMesh(mesh, part, stats);
+    if (part->closed && !part->oriented)
+        PMP::orient_to_bound_a_volume(mesh);
+
+    CGAL::get_default_random() = CGAL::Random(seed);
+    auto     vpmap = get(CGAL::vertex_point, mesh);
+    Metric   metric(mesh, vpmap);
+    Approximation approx(mesh, vpmap, metric);
+    approx.initialize_seeds(CGAL::parameters::seeding_method(VSA::HIERARCHICAL).
+                                              max_number_of_proxies(static_cast<std::size_t>(m_proxies)));
+    approx.run(static_cast<std::size_t>(m_iteration));
+    error = CGAL::to_double(approx.compute_total_error());
+
+    CGAL::get_default_random() = random;
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//
+// Variational Shape Approximation
+//
+LxResult CApproximate::ApproximateMesh(CLxUser_Mesh& base_mesh, CPartSink sink)
+{
+    LxResult result = Snapshot(base_mesh);
+    if (result != LXe_OK)
+        return result;
+    return Compute(sink);
+}
+
+//
+// Build the mesh from the snapshot and run the parts as a pipeline. Each part is converted and
+// approximated on a worker thread, and handed to the write-back sink on the calling thread in
+// part order, so the write-back of the finished parts overlaps the parts still running. The
+// triangulation stays a stage of its own, since the parts are found from the triangles.
+// The outputs of the parts are taken from the cached result if it is given, and kept in the
+// record if it is given.
+//
+LxResult CApproximate::Compute(CPartSink sink, const std::vector<CPartSnapshot>* cached, std::vector<CPartSnapshot>* record)
+{
+    // the mesh is built and the parts are run on the threads given by m_threads.
+    CThreadPool& pool = CThreadPool::Shared(static_cast<unsigned>(std::max(m_threads, 0)));
+
+    // the parts are built once per snapshot, and the live parts refer to them.
+    if (!m_built)
     {
-        ConvertFromCGALMesh(output, edit_mesh);
+        m_live.clear();
+        m_cmesh.m_debug = m_debug;
+        m_cmesh.BuildMesh(pool);
+        m_built = true;
     }
+
+    m_proxy_sources.clear();
+
+    auto& parts  = m_cmesh.m_parts;
+    auto  nparts = static_cast<unsigned>(parts.size());
+    if (m_keep_live)
+        m_live.resize(nparts);
+    if (cached && cached->size() != nparts)
+        cached = nullptr;
+    if (record)
+        record->assign(nparts, CPartSnapshot());
+    bool complete = true;
+
+    // parts given from the kept outputs (1) or repaired from the last segmentation (2)
+    std::vector<char> reused(nparts, 0);
+
+    std::vector<CPartOutput> outputs(nparts);
+    std::unique_ptr<std::atomic<bool>[]> done(new std::atomic<bool>[nparts]);
+    for (auto i = 0u; i < nparts; i++)
+        done[i].store(false, std::memory_order_relaxed);
+
+    // the largest parts start first, so the small ones fill up the threads at the end.
+    std::vector<unsigned> order(nparts);
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        return parts[a]->tris.size() > parts[b]->tris.size();
+    });
+
+    std::mutex              mutex;
+    std::condition_variable cond;
+
+    CTaskGroup group(pool);
+
+    // The parts in flight are started and not handed over yet. The window bounds the outputs
+    // held for an earlier part, and the next part to hand over is always started first, so the
+    // window never stalls.
+    unsigned          window   = std::max(4u, pool.NumThreads() * 2);
+    unsigned          inflight = 0;
+    unsigned          next     = 0;
+    std::vector<char> started(nparts, 0);
+
+    auto Start = [&](unsigned i) {
+        started[i] = 1;
+        inflight ++;
+        group.Run([this, i, cached, &parts, &outputs, &reused, &done, &mutex, &cond]() {
+            try
+            {
+                if (cached)
+                    outputs[i].result = (*cached)[i].Restore(parts[i], outputs[i], m_debug) ? LXe_OK : LXe_FAILED;
+                else if (RestorePart(parts[i], outputs[i]))
+                    reused[i] = 1;
+                else if (RepairPart(parts[i], outputs[i]))
+                    reused[i] = 2;
+                else
+                    outputs[i].result = ApproximatePart(parts[i], outputs[i]);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "part " << i << ": " << e.what() << "\n";
+                outputs[i].result = LXe_FAILED;
+            }
+            catch (...)
+            {
+                outputs[i].result = LXe_FAILED;
+            }
+            // a failed live part is seeded again at the next evaluation.
+            if (outputs[i].result != LXe_OK && m_keep_live)
+                m_live[i].reset();
+            done[i].store(true, std::memory_order_release);
+            std::lock_guard<std::mutex> lock(mutex);
+            cond.notify_all();
+        });
+    };
+
+    // Hand the results over in part order as soon as the previous parts are done, so the proxy
+    // sources and the output mesh are the same as a serial run.
+    for (auto i = 0u; i < nparts; i++)
+    {
+        if (!started[i])
+            Start(i);
+        while (inflight < window)
+        {
+            while (next < nparts && started[order[next]])
+                next ++;
+            if (next == nparts)
+                break;
+            Start(order[next]);
+        }
+
+        while (!done[i].load(std::memory_order_acquire))
+        {
+            if (pool.RunOne())
+                continue;
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait_for(lock, std::chrono::milliseconds(1), [&]() { return done[i].load(std::memory_order_acquire); });
+        }
+
+        CPartOutput& output = outputs[i];
+        if (output.result != LXe_OK)
+            complete = false;
+        else
+        {
+            if (record)
+                (*record)[i].Save(*this, parts[i], output);
+            if (!cached && !reused[i])
+                KeepPart(parts[i], output);
+        }
+        if (sink)
+            sink(parts[i], output);
+        if (output.result == LXe_OK && m_mode == CApproximate::SEGMENTATION)
+            m_proxy_sources.push_back(std::move(output.proxy_source));
+        output = CPartOutput();
+        inflight --;
+    }
+    group.Wait();
+
+    // a result with failed parts is not kept.
+    if (record && !complete)
+        record->clear();
+
+    if (m_part_cache && !cached && m_debug)
+        printf("parts: %u reused: %u\n", nparts, static_cast<unsigned>(std::count(reused.begin(), reused.end(), 1)));
+    if (m_repair_source && m_debug)
+        printf("parts: %u repaired: %u\n", nparts, static_cast<unsigned>(std::count(reused.begin(), reused.end(), 2)));
+    m_repair_source.reset();
+
+    //
+    // The flat layout is only a measurement. It is built from the labels of CMesh, and both
+    // layouts must report the same seams.
+    //
+    if (m_debug && complete)
+    {
+        CFlatMesh flat;
+        flat.BuildMesh(m_cmesh);
+        unsigned seams = 0;
+        for (auto& edge : m_cmesh.m_edges)
+        {
+            if (edge->tris.size() == 2 && edge->tris[0]->proxy != edge->tris[1]->proxy)
+                seams ++;
+        }
+        printf("Mesh layouts: CMesh %.1f bytes/triangle %u seams CFlatMesh %.1f bytes/triangle %u seams\n", m_cmesh.BytesPerTriangle(), seams, flat.BytesPerTriangle(), flat.NumSeams());
+    }
+
     return LXe_OK;
 }
 
 //
-// Write the segmentation result to the given mesh as polygon tags or edge selection set.
+// Prepare the given mesh for the segmentation write-back, and look up or create the vertex maps.
 //
-LxResult CApproximate::WriteSegmentations(CLxUser_Mesh& edit_mesh)
+LxResult CApproximate::BeginSegmentations(CLxUser_Mesh& edit_mesh)
 {
-    if (m_proxy_sources.size() == 0)
-        return LXe_FAILED;
-
-    CLxUser_MeshService mesh_svc;
-
     m_mesh.set(edit_mesh);
+    m_edge.fromMesh(m_mesh);
+    m_poly.fromMesh(m_mesh);
+    m_vert.fromMesh(m_mesh);
+    m_vmap.fromMesh(m_mesh);
+
+    m_sset_map  = nullptr;
+    m_color_map = nullptr;
 
     if (m_segment == Segmentation::EDGE_SSET)
     {
-        m_edge.fromMesh(m_mesh);
-        m_vmap.fromMesh(m_mesh);
-
-        LXtMeshMapID    vmap_id;
         if (LXx_FAIL(m_vmap.SelectByName(LXi_VMAP_EPCK, m_sset.c_str())))
-            m_vmap.New(LXi_VMAP_EPCK, m_sset.c_str(), &vmap_id);
+            m_vmap.New(LXi_VMAP_EPCK, m_sset.c_str(), &m_sset_map);
         else
-            vmap_id = m_vmap.ID();
+            m_sset_map = m_vmap.ID();
+    }
+    if (m_set_color)
+    {
+        if (LXx_FAIL(m_vmap.SelectByName(LXi_VMAP_RGB, "Segment")))
+            m_vmap.New(LXi_VMAP_RGB, "Segment", &m_color_map);
+        else
+            m_color_map = m_vmap.ID();
+    }
+    return LXe_OK;
+}
 
-        for (auto& edge : m_cmesh.m_edges)
+//
+// Write the segmentation of a part as polygon tags or edge selection set. The triangles of a
+// polygon are listed together in the part, so each polygon is written once.
+//
+LxResult CApproximate::WriteSegmentation(CPartID part)
+{
+    if (m_segment == Segmentation::EDGE_SSET)
+    {
+        // every edge is listed at both vertices, and written from its first one.
+        for (auto& v : part->vrts)
         {
-            if (edge->tris.size() == 2)
+            for (auto& edge : v->edge)
             {
+                if (edge->v0 != v || edge->tris.size() != 2)
+                    continue;
+                if (edge->tris[0]->part != edge->tris[1]->part)
+                    continue;
                 if (edge->tris[0]->proxy != edge->tris[1]->proxy)
                 {
                     float value = 1.0;
                     m_edge.SelectEndpoints(edge->v0->vrt, edge->v1->vrt);
-                    m_edge.SetMapValue(vmap_id, &value);
+                    m_edge.SetMapValue(m_sset_map, &value);
                 }
             }
         }
     }
     else
     {
-        m_poly.fromMesh(m_mesh);
-        m_vert.fromMesh(m_mesh);
-        m_vmap.fromMesh(m_mesh);
-    
         CLxUser_StringTag polyTag;
         LXtID4 type;
         if (m_segment == Segmentation::POLY_MATR)
@@ -338,51 +969,55 @@ LxResult CApproximate::WriteSegmentations(CLxUser_Mesh& edit_mesh)
         else
             type = LXi_PTAG_PART;
 
-        for (auto& face : m_cmesh.m_faces)
+        LXtPolygonID last = nullptr;
+        for (auto& tri : part->tris)
         {
-            CTriangleID tri = face.second.tris[0];
-            m_poly.Select(face.first);
+            if (tri->pol == last)
+                continue;
+            last = tri->pol;
+            m_poly.Select(tri->pol);
             std::string tag = std::to_string(tri->proxy);
-            if (m_proxy_sources.size() > 1)
-                tag = std::to_string(face.second.part) + "-" + tag;
+            if (m_cmesh.m_parts.size() > 1)
+                tag = std::to_string(part->index) + "-" + tag;
             polyTag.set(m_poly);
             polyTag.Set(type, tag.c_str());
         }
     }
     if (m_set_color)
     {
-        m_poly.fromMesh(m_mesh);
-        m_vmap.fromMesh(m_mesh);
-
-        LXtMeshMapID    vmap_id = nullptr;
-        if (LXx_FAIL(m_vmap.SelectByName(LXi_VMAP_RGB, "Segment")))
-            m_vmap.New(LXi_VMAP_RGB, "Segment", &vmap_id);
-        else
-            vmap_id = m_vmap.ID();
-        auto proxy_count = m_proxy_sources[0].size();
-        for (auto i = 1u; i < m_proxy_sources.size(); i++)
+        LXtPolygonID last = nullptr;
+        for (auto& tri : part->tris)
         {
-            if (m_proxy_sources[i].size() > proxy_count)
-                proxy_count = m_proxy_sources[i].size();
-        }
-        UpdateProxyColors(proxy_count);
-
-        for (auto& face : m_cmesh.m_faces)
-        {
-            CTriangleID tri = face.second.tris[0];
-            m_poly.Select(face.first);
+            if (tri->pol == last)
+                continue;
+            last = tri->pol;
+            m_poly.Select(tri->pol);
             unsigned count;
             float color[3];
-            for (auto i = 0u; i < 3; ++i)
-                color[i] = g_proxy_color[tri->proxy][i];
+            ProxyColor(tri->proxy, color);
             m_poly.VertexCount(&count);
             for (auto i = 0u; i < count; i++)
             {
                 LXtPointID pntID;
                 m_poly.VertexByIndex(i, &pntID);
-                m_poly.SetMapValue(pntID, vmap_id, color);
+                m_poly.SetMapValue(pntID, m_color_map, color);
             }
         }
     }
     return LXe_OK;
-}
\ No newline at end of file
+}
+
+//
+// Write the segmentation result to the given mesh as polygon tags or edge selection set.
+//
+LxResult CApproximate::WriteSegmentations(CLxUser_Mesh& edit_mesh)
+{
+    if (m_proxy_sources.size() == 0)
+        return LXe_FAILED;
+
+    BeginSegmentations(edit_mesh);
+
+    for (auto& part : m_cmesh.m_parts)
+        WriteSegmentation(part);
+    return LXe_OK;
+}
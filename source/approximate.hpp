@@ -20,19 +20,149 @@
 #include <boost/geometry/geometries/segment.hpp>
 
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
+#include <CGAL/Simple_cartesian.h>
 #include <CGAL/Surface_mesh.h>
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel     Kernel;
 typedef Kernel::Point_3                                         Point_3;
 typedef CGAL::Surface_mesh<Point_3>                             Surface_mesh;
 
+// kernels selectable for the VSA path
+typedef CGAL::Simple_cartesian<double>                          Cartesian_kernel;
+typedef CGAL::Simple_cartesian<float>                           Cartesian_float_kernel;
+
 #include <vector>
+#include <array>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <unordered_set>
 #include <random>
 #include <iostream>
 
 #include "util.hpp"
 #include "cmesh.hpp"
+#include "flatmesh.hpp"
+
+//
+// Triangle of the soup of an approximated part.
+//
+typedef std::array<std::size_t, 3>  CSoupTriangle;
+
+//
+// Write triangle soups to a Modo mesh. The accessors and the point ID buffer are kept over the
+// parts written to the same mesh. Only the points used by the triangles are created, and
+// degenerated triangles are skipped.
+//
+struct CSoupWriter
+{
+    CLxUser_Polygon         m_poly;
+    CLxUser_Point           m_vert;
+    std::vector<LXtPointID> m_point_ids;
+
+    unsigned m_points = 0;
+    unsigned m_polygons = 0;
+
+    CSoupWriter(CLxUser_Mesh& mesh)
+    {
+        m_poly.fromMesh(mesh);
+        m_vert.fromMesh(mesh);
+    }
+
+    LxResult Write(const std::vector<Point_3>& points, const std::vector<CSoupTriangle>& triangles)
+    {
+        m_point_ids.assign(points.size(), nullptr);
+
+        LXtPointID vrts[3];
+        for (auto& tri : triangles)
+        {
+            if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0])
+                continue;
+            for (auto i = 0u; i < 3; i++)
+            {
+                if (tri[i] >= points.size())
+                    return LXe_OUTOFBOUNDS;
+                LXtPointID& id = m_point_ids[tri[i]];
+                if (!id)
+                {
+                    const Point_3& p = points[tri[i]];
+                    LXtVector pos;
+                    LXx_VSET3(pos, p.x(), p.y(), p.z());
+                    if (LXx_FAIL(m_vert.New(pos, &id)))
+                        return LXe_FAILED;
+                    m_points ++;
+                }
+                vrts[i] = id;
+            }
+            LXtPolygonID new_pol;
+            if (LXx_FAIL(m_poly.New(LXiPTYP_FACE, vrts, 3, 0, &new_pol)))
+                return LXe_FAILED;
+            m_polygons ++;
+        }
+        return LXe_OK;
+    }
+};
+
+//
+// Result of a part, computed on a worker thread and handed over in part order.
+//
+struct CPartOutput
+{
+    LxResult                    result = LXe_OK;
+    std::vector<CTriangleID>    proxy_source;   // segmentation: a triangle of each proxy
+    std::vector<Point_3>        points;         // approximation: triangle soup
+    std::vector<CSoupTriangle>  triangles;
+};
+
+//
+// Write-back stage of the parts. The sink is called on the thread running Compute(), in part
+// order, as soon as the part and the parts before it are done. The output is freed on return.
+//
+typedef std::function<void(CPartID part, CPartOutput& output)> CPartSink;
+
+struct CApproximate;
+class  CResultCache;
+
+//
+// Output of a live part for a number of proxies and iterations. It answers a return to earlier
+// settings, since the partition of a live part cannot be relaxed backwards.
+//
+struct CPartSnapshot
+{
+    int                         proxies = 0;
+    int                         iteration = 0;
+    int                         mode = 0;
+    std::vector<unsigned>       tri_proxy;      // segmentation: proxy of each part triangle
+    std::vector<Point_3>        points;         // approximation: triangle soup
+    std::vector<CSoupTriangle>  triangles;
+
+    void     Save(const CApproximate& context, CPartID part, const CPartOutput& output);
+    bool     Restore(CPartID part, CPartOutput& output, int debug) const;
+    bool     Matches(const CApproximate& context) const;
+
+    size_t MemoryUsage() const
+    {
+        return sizeof(*this) + tri_proxy.capacity() * sizeof(unsigned) + points.capacity() * sizeof(Point_3) +
+               triangles.capacity() * sizeof(CSoupTriangle);
+    }
+};
+
+//
+// Approximation of a part kept alive between evaluations. A new number of proxies refines the
+// partition of the last evaluation, and more iterations continue its relaxation, instead of
+// seeding the part again.
+//
+struct CLivePart
+{
+    int                       m_iteration = 0;  // iterations the partition is relaxed for
+    std::deque<CPartSnapshot> m_snapshots;      // the latest last
+
+    virtual ~CLivePart() {}
+    virtual LxResult Update(CApproximate& context, CPartID part, CPartOutput& output) = 0;
+
+    bool Restore(const CApproximate& context, CPartID part, CPartOutput& output) const;
+    void Save(const CApproximate& context, CPartID part, const CPartOutput& output);
+};
 
 struct CApproximate
 {
@@ -47,13 +177,16 @@ struct CApproximate
         POLY_PART,
         EDGE_SSET,
     };
+    enum KernelType : int
+    {
+        EPICK = 0,
+        CARTESIAN,
+        CARTESIAN_FLOAT,
+    };
 
     // source mesh context
     CMesh m_cmesh;
 
-    // CGAL surface mesh
-    std::vector<Surface_mesh> m_outputs;
-
     std::vector<std::vector<CTriangleID>> m_proxy_sources;
 
     unsigned m_part;    // current connecting part
@@ -82,9 +215,29 @@ struct CApproximate
     int    m_segment;
     int    m_new_mesh;
     int    m_set_color;
+    int    m_kernel;    // geometry kernel of the VSA path
+    int    m_debug;     // full validation and verbose output
+    int    m_threads;   // number of threads for the parts, 0 for all cores
+    int    m_seed;      // seed of the proxies, negative for a new seed at every run
 
     std::string m_sset;
 
+    // segmentation write-back
+    LXtMeshMapID m_sset_map;
+    LXtMeshMapID m_color_map;
+
+    // live parts, kept for the next evaluation when m_keep_live is set
+    std::vector<std::unique_ptr<CLivePart>> m_live;
+    bool     m_keep_live;
+    bool     m_built;           // the parts are built from the snapshot
+    uint64_t m_snapshot_hash;
+
+    // outputs of the parts by fingerprint, kept over evaluations
+    CResultCache* m_part_cache;
+
+    // last segmentation of the edited mesh, repaired around the moved triangles
+    std::shared_ptr<CApproximate> m_repair_source;
+
     CApproximate()
     {
         m_mode  = Mode::SEGMENTATION;
@@ -93,7 +246,17 @@ struct CApproximate
         m_segment = Segmentation::POLY_MATR;
         m_new_mesh = 1;
         m_set_color = 1;
+        m_kernel = KernelType::EPICK;
+        m_debug = 0;
+        m_threads = 0;
+        m_seed = 0;
         m_sset = "Segment";
+        m_sset_map = nullptr;
+        m_color_map = nullptr;
+        m_keep_live = false;
+        m_built = false;
+        m_snapshot_hash = 0;
+        m_part_cache = nullptr;
 
         CLxUser_MeshService mesh_svc;
         m_pick      = mesh_svc.SetMode(LXsMARK_SELECT);
@@ -107,8 +270,24 @@ struct CApproximate
     // Variational Shape Approximation
     //
     LxResult BuildMesh (CLxUser_Mesh& base_mesh);
-    LxResult ApproximateMesh (CLxUser_Mesh& base_mesh);
-    LxResult ApproximatePart (CLxUser_Mesh& base_mesh, CPartID part);
+    LxResult Snapshot (CLxUser_Mesh& base_mesh);
+    LxResult Compute (CPartSink sink = nullptr, const std::vector<CPartSnapshot>* cached = nullptr, std::vector<CPartSnapshot>* record = nullptr);
+    LxResult ApproximateMesh (CLxUser_Mesh& base_mesh, CPartSink sink = nullptr);
+    LxResult ApproximatePart (CPartID part, CPartOutput& output);
+    template <typename K>
+    LxResult ApproximatePartWith (CPartID part, CPartOutput& output);
+    template <typename K>
+    double   MeasureKernel (CPartID part, unsigned seed, double& error) const;
+    bool     CanRefine (const CApproximate& other) const;
+    bool     CanRepair (const CApproximate& other) const;
+    void     CopySettings (const CApproximate& other);
+    uint64_t SettingsKey (uint64_t hash) const;
+    uint64_t ResultKey () const;
+    uint64_t PartKey (CPartID part) const;
+    bool     RestorePart (CPartID part, CPartOutput& output);
+    void     KeepPart (CPartID part, const CPartOutput& output);
+    bool     RepairPart (CPartID part, CPartOutput& output);
+    LxResult BeginSegmentations (CLxUser_Mesh& edit_mesh);
+    LxResult WriteSegmentation (CPartID part);
     LxResult WriteSegmentations (CLxUser_Mesh& edit_mesh);
-    LxResult WriteApproximation (CLxUser_Mesh& edit_mesh);
 };
\ No newline at end of file
@@ -0,0 +1,162 @@
+//
+// Result cache of the procedural mesh operator.
+// The results are kept over the evaluations of the operator, so an evaluation of the same
+// snapshot with the same settings writes back the kept parts without running the VSA.
+//
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "approximate.hpp"
+
+//
+// Results keyed by the hash of the snapshot or the part and the settings computing the parts.
+// The least recently used results are dropped when the results exceed the memory cap.
+//
+class CResultCache
+{
+public:
+    static constexpr unsigned default_megabytes = 256;
+
+    typedef std::vector<CPartSnapshot>     Result;
+    typedef std::shared_ptr<const Result>  ResultPtr;
+
+    CResultCache(const char* name) : m_name(name) {}
+
+    //
+    // Results of the snapshots.
+    //
+    static CResultCache& Shared()
+    {
+        static CResultCache cache("results");
+        return cache;
+    }
+
+    //
+    // Outputs of the parts. These are kept apart from the results of the snapshots, so the many
+    // small part entries do not evict the results and the counts tell the two apart.
+    //
+    static CResultCache& Parts()
+    {
+        static CResultCache cache("parts");
+        return cache;
+    }
+
+    //
+    // Set the memory cap in megabytes of both caches, only when the cap is changed. 0 disables
+    // the caches and drops the results.
+    //
+    static void SetCapacities(unsigned megabytes)
+    {
+        static std::mutex mutex;
+        static unsigned   current = default_megabytes;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (megabytes == current)
+            return;
+        current = megabytes;
+        Shared().SetCapacity(megabytes);
+        Parts().SetCapacity(megabytes);
+    }
+
+    //
+    // Set the memory cap in megabytes. 0 disables the cache and drops the results.
+    //
+    void SetCapacity(unsigned megabytes)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = static_cast<size_t>(megabytes) << 20;
+        Evict();
+    }
+
+    bool Enabled()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_capacity > 0;
+    }
+
+    //
+    // Return the result of the key and make it the most recently used, or null if there is none.
+    //
+    ResultPtr Find(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it == m_index.end())
+        {
+            m_misses ++;
+            return nullptr;
+        }
+        m_hits ++;
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        return it->second->result;
+    }
+
+    //
+    // Keep the result of the key. A result larger than the cap is not kept.
+    //
+    void Insert(uint64_t key, Result&& result)
+    {
+        size_t bytes = 0;
+        for (auto& part : result)
+            bytes += part.MemoryUsage();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (bytes > m_capacity)
+            return;
+
+        auto it = m_index.find(key);
+        if (it != m_index.end())
+        {
+            m_bytes -= it->second->bytes;
+            m_lru.erase(it->second);
+            m_index.erase(it);
+        }
+
+        Entry entry;
+        entry.key    = key;
+        entry.bytes  = bytes;
+        entry.result = std::make_shared<const Result>(std::move(result));
+        m_lru.push_front(std::move(entry));
+        m_index[key] = m_lru.begin();
+        m_bytes += bytes;
+        Evict();
+    }
+
+    void Print()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        printf("cache %s: hits %u misses %u results %zu bytes %zu\n", m_name, m_hits, m_misses, m_lru.size(), m_bytes);
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t  key;
+        size_t    bytes;
+        ResultPtr result;
+    };
+
+    void Evict()
+    {
+        while (m_bytes > m_capacity && !m_lru.empty())
+        {
+            m_bytes -= m_lru.back().bytes;
+            m_index.erase(m_lru.back().key);
+            m_lru.pop_back();
+        }
+    }
+
+    const char*                                              m_name;
+    std::mutex                                               m_mutex;
+    std::list<Entry>                                         m_lru;     // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+    size_t                                                   m_bytes = 0;
+    size_t                                                   m_capacity = static_cast<size_t>(default_megabytes) << 20;
+    unsigned                                                 m_hits = 0;
+    unsigned                                                 m_misses = 0;
+};
@@ -13,9 +13,15 @@
 #include <lxsdk/lxu_quaternion.hpp>
 
 #include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
 #include <unordered_set>
 
 #include "util.hpp"
+#include "snapshot.hpp"
+#include "parallel.hpp"
 #include "triangulate.hpp"
 
 struct CVerx;
@@ -48,6 +54,7 @@ struct CVerx
 struct CEdge
 {
     CVerxID                     v0, v1;  // vertex 1,2
+    unsigned                    index;      // index in CMesh::m_edges
     std::vector<CTriangleID>    tris;       // connecting triangles
     bool                        collapsed;  // edge collapsed flag
 };
@@ -75,10 +82,266 @@ struct CPart
 {
     unsigned                    index;
     bool                        no_source = false;
+    bool                        closed = true;      // no border edges
+    bool                        manifold = true;    // no edges shared by more than two triangles
+    bool                        oriented = true;    // neighbor triangles run their edges in opposite directions
+    uint64_t                    topology = 0;       // hash of the triangles
+    uint64_t                    fingerprint = 0;    // hash of the vertex positions and the triangles
     std::vector<CTriangleID>    tris = {};  // triangles of the part
     std::vector<CVerxID>        vrts = {};  // vertices of the triangles
 };
 
+//
+// Triangulation stage. The selected surface polygons of the snapshot are triangulated in
+// parallel in blocks of consecutive polygons, and the results are handed to the context in
+// polygon index order, so the output is the same as a serial run. The context receives
+// AddPolygon() for every surface polygon and AddTriangle() for every triangle generated from it,
+// both given by snapshot indices.
+//
+template <typename Context>
+class TripleFaceVisitor
+{
+public:
+    static constexpr unsigned block_size = 256;
+
+    struct CBlock
+    {
+        std::vector<unsigned> count;    // number of triangles of each polygon
+        std::vector<CTriple>  tris;
+        CTriangulateStats     stats;
+    };
+
+    TripleFaceVisitor(const CMeshSnapshot& snap, Context* context) : m_snap(snap), m_context(context) {}
+
+    void Enum(CThreadPool& pool)
+    {
+        std::vector<unsigned> pols;
+        for (auto i = 0u; i < m_snap.NumPolygons(); i++)
+        {
+            if (m_snap.IsTarget(i))
+                pols.push_back(i);
+        }
+
+        auto npol   = static_cast<unsigned>(pols.size());
+        auto nblock = (npol + block_size - 1) / block_size;
+        std::vector<CBlock> blocks(nblock);
+
+        ParallelFor(pool, 0u, nblock, 1u, [&](unsigned begin, unsigned end) {
+            CTriangulate         tri(m_snap);
+            std::vector<CTriple> tris;
+            for (auto b = begin; b < end; b++)
+            {
+                CBlock& block = blocks[b];
+                for (auto k = b * block_size; k < std::min(npol, (b + 1) * block_size); k++)
+                {
+                    tri.Polygon(pols[k], tris);
+                    block.count.push_back(static_cast<unsigned>(tris.size()));
+                    block.tris.insert(block.tris.end(), tris.begin(), tris.end());
+                }
+                block.stats = tri.m_stats;
+                tri.m_stats = CTriangulateStats();
+            }
+        });
+
+        for (auto b = 0u; b < nblock; b++)
+        {
+            CBlock& block = blocks[b];
+            auto    t     = 0u;
+            m_stats.Add(block.stats);
+            for (auto i = 0u; i < block.count.size(); i++)
+            {
+                auto pol = pols[b * block_size + i];
+                m_context->AddPolygon(pol);
+                for (auto n = t + block.count[i]; t < n; t++)
+                    m_context->AddTriangle(pol, block.tris[t][0], block.tris[t][1], block.tris[t][2]);
+            }
+            std::vector<CTriple>().swap(block.tris);
+        }
+    }
+
+    const CMeshSnapshot& m_snap;
+    Context*             m_context;
+    CTriangulateStats    m_stats;       // polygons triangulated by each path
+};
+
+//
+// Vertex resolution stage. This maps a polygon corner (point, polygon) to a vertex slot. The
+// corners of a source point share one slot per fan around the point (see
+// CMeshSnapshot::PointFans), so vertices are split at hidden or locked polygons. The fans of a
+// point are computed once, when the point is first seen, and the slot of every polygon around
+// the point is kept in the point to polygon link order of the snapshot.
+//
+struct CVerxResolver
+{
+    static constexpr unsigned npos = ~0u;
+
+    void Reset(const CMeshSnapshot& snap)
+    {
+        m_snap  = &snap;
+        m_nslot = 0;
+        m_link_slot.assign(snap.m_point_pol.size(), npos);
+    }
+
+    //
+    // Return the vertex slot of the corner of the point p in the polygon pol.
+    //
+    unsigned Resolve(unsigned p, unsigned pol)
+    {
+        auto begin = m_snap->m_point_pol_offset[p];
+        auto end   = m_snap->m_point_pol_offset[p + 1];
+        if (begin == end)
+            return m_nslot ++;
+
+        if (m_link_slot[begin] == npos)
+            ResolvePoint(p);
+
+        for (auto k = begin; k < end; k++)
+        {
+            if (m_snap->m_point_pol[k] == pol)
+                return m_link_slot[k];
+        }
+        return m_link_slot[begin];
+    }
+
+    void ResolvePoint(unsigned p)
+    {
+        auto begin = m_snap->m_point_pol_offset[p];
+        auto npol  = m_snap->PointFans(p, m_group);
+
+        // fan roots are the smallest link index of the fan.
+        m_fan_slot.resize(npol);
+        for (auto i = 0u; i < npol; i++)
+        {
+            if (m_group[i] == i)
+                m_fan_slot[i] = m_nslot ++;
+        }
+        for (auto i = 0u; i < npol; i++)
+            m_link_slot[begin + i] = m_fan_slot[m_group[i]];
+    }
+
+    const CMeshSnapshot*  m_snap = nullptr;
+    std::vector<unsigned> m_link_slot;      // vertex slot of each point to polygon link
+    std::vector<unsigned> m_group;
+    std::vector<unsigned> m_fan_slot;
+    unsigned              m_nslot = 0;
+};
+
+//
+// Open addressing hash table of edges keyed on the sorted vertex index pair. This uses linear
+// probing with backward shift deletion, so there are no tombstones after CollapseEdge.
+//
+struct CEdgeTable
+{
+    static constexpr uint64_t empty = ~0ull;
+    static constexpr unsigned npos  = ~0u;
+
+    //
+    // Make room for the given number of edges at half load. Stored edges are kept.
+    //
+    void Reserve(size_t nedge)
+    {
+        size_t capacity = 16;
+        while (capacity < nedge * 2)
+            capacity <<= 1;
+        if (capacity <= m_keys.size())
+            return;
+
+        std::vector<uint64_t> keys(capacity, empty);
+        std::vector<unsigned> values(capacity, npos);
+        keys.swap(m_keys);
+        values.swap(m_values);
+        m_mask  = capacity - 1;
+        m_count = 0;
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            if (keys[i] != empty)
+                Insert(static_cast<unsigned>(keys[i] >> 32), static_cast<unsigned>(keys[i]), values[i]);
+        }
+    }
+
+    void Clear()
+    {
+        std::vector<uint64_t>().swap(m_keys);
+        std::vector<unsigned>().swap(m_values);
+        m_mask  = 0;
+        m_count = 0;
+    }
+
+    static uint64_t Key(unsigned a, unsigned b)
+    {
+        return a < b ? (static_cast<uint64_t>(a) << 32 | b) : (static_cast<uint64_t>(b) << 32 | a);
+    }
+
+    size_t Slot(uint64_t key) const
+    {
+        return static_cast<size_t>(MeshUtil::Mix64(key)) & m_mask;
+    }
+
+    unsigned Find(unsigned a, unsigned b) const
+    {
+        if (m_keys.empty())
+            return npos;
+        uint64_t key = Key(a, b);
+        for (size_t i = Slot(key); m_keys[i] != empty; i = (i + 1) & m_mask)
+        {
+            if (m_keys[i] == key)
+                return m_values[i];
+        }
+        return npos;
+    }
+
+    void Insert(unsigned a, unsigned b, unsigned value)
+    {
+        if ((m_count + 1) * 2 > m_keys.size())
+            Reserve(m_count + 1 > 8 ? (m_count + 1) * 2 : 8);
+        uint64_t key = Key(a, b);
+        size_t   i   = Slot(key);
+        while (m_keys[i] != empty && m_keys[i] != key)
+            i = (i + 1) & m_mask;
+        if (m_keys[i] == empty)
+            m_count ++;
+        m_keys[i]   = key;
+        m_values[i] = value;
+    }
+
+    // Remove the edge when the key is stored with the given value.
+    void Erase(unsigned a, unsigned b, unsigned value)
+    {
+        if (m_keys.empty())
+            return;
+        uint64_t key = Key(a, b);
+        size_t   i   = Slot(key);
+        while (m_keys[i] != key)
+        {
+            if (m_keys[i] == empty)
+                return;
+            i = (i + 1) & m_mask;
+        }
+        if (m_values[i] != value)
+            return;
+
+        // shift back the following entries of the probe sequence.
+        for (size_t j = (i + 1) & m_mask; m_keys[j] != empty; j = (j + 1) & m_mask)
+        {
+            size_t home = Slot(m_keys[j]);
+            if (((j - home) & m_mask) >= ((j - i) & m_mask))
+            {
+                m_keys[i]   = m_keys[j];
+                m_values[i] = m_values[j];
+                i = j;
+            }
+        }
+        m_keys[i]   = empty;
+        m_values[i] = npos;
+        m_count --;
+    }
+
+    std::vector<uint64_t> m_keys;
+    std::vector<unsigned> m_values;
+    size_t                m_mask  = 0;
+    size_t                m_count = 0;
+};
+
 struct CMesh
 {
     CMesh()
@@ -89,16 +352,17 @@ struct CMesh
         m_mark_seam = mesh_svc.SetMode(LXsMARK_USER_1);
         m_mark_hide = mesh_svc.SetMode(LXsMARK_HIDE);
         m_mark_lock = mesh_svc.SetMode(LXsMARK_LOCK);
+        m_debug     = 0;
     }
 
-    LxResult AddPolygon(LXtPolygonID pol)
+    LxResult AddPolygon(unsigned pol)
     {
         CFace face;
-        m_faces[pol] = face;
+        m_faces[m_snapshot.m_pol_id[pol]] = face;
         return LXe_OK;
     }
 
-    LxResult AddTriangle(LXtPolygonID pol, LXtPointID v0, LXtPointID v1, LXtPointID v2)
+    LxResult AddTriangle(unsigned pol, unsigned v0, unsigned v1, unsigned v2)
     {
         m_triangles.push_back(std::make_shared<CTriangle>());
         CTriangleID tri = m_triangles.back();
@@ -109,19 +373,14 @@ struct CMesh
         dv[1] = AddVertex(v1, pol, tri);
         dv[2] = AddVertex(v2, pol, tri);
 
-        CLxUser_Edge edge;
-        edge.fromMesh(m_mesh);
-
-        if (pol)
-        {
-            CFace& face = m_faces[pol];
-            face.tris.push_back(tri);
-        }
+        CFace& face = m_faces[m_snapshot.m_pol_id[pol]];
+        face.tris.push_back(tri);
 
         tri->v0   = dv[0];
         tri->v1   = dv[1];
         tri->v2   = dv[2];
-        tri->pol  = pol;
+        tri->pol  = m_snapshot.m_pol_id[pol];
+        tri->pol_index = static_cast<int>(pol);
         tri->updated = false;
         tri->deleted = false;
         tri->proxy = 0;
@@ -135,13 +394,11 @@ struct CMesh
     LxResult AddEdge(CVerxID v0, CVerxID v1, CTriangleID tri)
     {
         // Check if the edge already exists
-        for (auto& edge : v0->edge)
+        unsigned index = m_edge_table.Find(v0->index, v1->index);
+        if (index != CEdgeTable::npos)
         {
-            if ((edge->v0 == v0 && edge->v1 == v1) || (edge->v0 == v1 && edge->v1 == v0))
-            {
-                edge->tris.push_back(tri);
-                return LXe_OK;
-            }
+            m_edges[index]->tris.push_back(tri);
+            return LXe_OK;
         }
 
         // Create a new edge
@@ -149,391 +406,292 @@ struct CMesh
         CEdgeID edge = m_edges.back();
         edge->v0 = v0;
         edge->v1 = v1;
+        edge->index = static_cast<unsigned>(m_edges.size() - 1);
         edge->collapsed = false;
         edge->tris.push_back(tri);
+        m_edge_table.Insert(v0->index, v1->index, edge->index);
 
         v0->edge.push_back(edge);
         v1->edge.push_back(edge);
         return LXe_OK;
     }
 
-    LXtPolygonID TracePolygon(LXtPointID vrt, LXtPolygonID pol, int shift)
+    //
+    // Get the vertex of the polygon corner. The resolver gives one vertex slot per fan of the
+    // source point, so the vertex is found without searching the triangles around the point.
+    //
+    CVerxID AddVertex(unsigned p, unsigned pol, CTriangleID tri)
     {
-        CLxUser_Edge edge;
-        edge.fromMesh(m_mesh);
-
-        CLxUser_Polygon poly;
-        poly.fromMesh(m_mesh);
-
-        LXtPolygonID pol1;
-        LXtPointID   vrt1;
-        unsigned int npol, nvert;
+        unsigned slot = m_resolver.Resolve(p, pol);
+        if (slot >= m_slots.size())
+            m_slots.resize(slot + 1);
 
-        m_poly.Select(pol);
-        m_poly.VertexCount(&nvert);
-
-        for (auto i = 0u; i < nvert; i++)
+        CVerxID& dv = m_slots[slot];
+        if (dv)
         {
-            m_poly.VertexByIndex(i, &vrt1);
-            if (vrt1 == vrt)
-            {
-                m_poly.VertexByIndex((i + shift + nvert) % nvert, &vrt1);
-                edge.SelectEndpoints(vrt, vrt1);
-                edge.PolygonCount(&npol);
-                for (auto j = 0u; j < npol; j++)
-                {
-                    edge.PolygonByIndex(j, &pol1);
-                    poly.Select(pol1);
-                    if (poly.TestMarks(m_mark_hide) == LXe_TRUE)
-                        continue;
-                    if (poly.TestMarks(m_mark_lock) == LXe_TRUE)
-                        continue;
-                    if (pol1 != pol)
-                    {
-                        return pol1;
-                    }
-                }
-                return nullptr;
-            }
+            dv->tris.push_back(tri);
+            return dv;
         }
-        return nullptr;
+
+        m_vertices.push_back(std::make_shared<CVerx>());
+        dv = m_vertices.back();
+
+        dv->tris.push_back(tri);
+        dv->vrt   = m_snapshot.m_point_id[p];
+        dv->tri   = tri;
+        dv->index = static_cast<unsigned>(m_vertices.size()-1);
+        dv->marks = LXiMARK_ANY;
+        dv->collapsed = false;
+        LXx_VCPY(dv->pos, m_snapshot.Pos(p));
+        LXx_VCPY(dv->new_pos, dv->pos);
+        dv->vrt_index = p;
+        return dv;
     }
 
-    // Find and get the CTriangle with the given vrt and pol.
-    CTriangleID FetchTriangle(LXtPointID vrt, LXtPolygonID pol)
+    //
+    // Divide the faces into parts connected by the polygon edges. Polygons sharing an edge are
+    // joined by a union-find in parallel unless one of them is hidden or locked, and unselected
+    // polygons join the faces around them like the vertex fans do, so a vertex belongs to one
+    // part. Parts are numbered in order of their first face.
+    //
+    void BuildParts(CThreadPool& pool)
     {
-        LXtPolygonID pol0 = pol;
-        unsigned int npol;
-
-        m_vert.Select(vrt);
-        m_vert.PolygonCount(&npol);
+        const CMeshSnapshot& snap = m_snapshot;
+        auto npol = snap.NumPolygons();
 
-        if (m_faces.find(pol) != m_faces.end())
+        std::vector<CFace*> faces(npol, nullptr);
+        for (auto& face : m_faces)
         {
-            CFace& face = m_faces[pol];
-            for (auto& tri : face.tris)
-            {
-                if (tri->v0->vrt == vrt || tri->v1->vrt == vrt || tri->v2->vrt == vrt)
-                    return tri;
-            }
+            if (!face.second.tris.empty())
+                faces[face.second.tris[0]->pol_index] = &face.second;
         }
-        npol--;
+        auto joinable = [&](unsigned pol) {
+            return !snap.Hidden(pol) && !snap.Locked(pol);
+        };
 
-        pol = pol0;
-        while (npol > 0)
-        {
-            pol = TracePolygon(vrt, pol, +1);
-            if (!pol)
-                break;
-            if (pol == pol0)
-                break;
-            if (m_faces.find(pol) != m_faces.end())
+        CUnionFind uf(npol);
+        ParallelFor(pool, 0u, npol, 1024u, [&](unsigned begin, unsigned end) {
+            for (auto pol = begin; pol < end; pol++)
             {
-                CFace& face = m_faces[pol];
-                for (auto& tri : face.tris)
+                if (!joinable(pol))
+                    continue;
+                auto nvert = snap.VertexCount(pol);
+                auto vrts  = snap.Vertices(pol);
+                for (auto j = 0u; j < nvert; j++)
                 {
-                    if (tri->v0->vrt == vrt || tri->v1->vrt == vrt || tri->v2->vrt == vrt)
-                        return tri;
+                    snap.ForEachEdgePolygon(vrts[j], vrts[(j + 1) % nvert], [&](unsigned pol1) {
+                        if (pol1 > pol && joinable(pol1))
+                            uf.Union(pol, pol1);
+                    });
                 }
             }
-            npol--;
-        }
+        });
 
-        pol = pol0;
-        while (npol > 0)
+        // the root of a part is its first polygon.
+        std::vector<unsigned> part_of(npol, ~0u);
+        for (auto pol = 0u; pol < npol; pol++)
         {
-            pol = TracePolygon(vrt, pol, -1);
-            if (!pol)
-                break;
-            if (pol == pol0)
-                break;
-            if (m_faces.find(pol) != m_faces.end())
+            if (!faces[pol])
+                continue;
+            auto root = uf.Find(pol);
+            if (part_of[root] == ~0u)
             {
-                CFace& face = m_faces[pol];
-                for (auto& tri : face.tris)
-                {
-                    if (tri->v0->vrt == vrt || tri->v1->vrt == vrt || tri->v2->vrt == vrt)
-                        return tri;
-                }
+                part_of[root] = static_cast<unsigned>(m_parts.size());
+                m_parts.push_back(std::make_shared<CPart>());
+                m_parts.back()->index = part_of[root];
             }
-            npol--;
-        }
-
-        return nullptr;
-    }
-
-    CVerxID FetchVertex(LXtPointID vrt)
-    {
-        m_vert.Select(vrt);
-        unsigned count;
-        m_vert.PolygonCount(&count);
-        for (auto i = 0u; i < count; i++)
-        {
-            LXtPolygonID pol;
-            m_vert.PolygonByIndex(i, &pol);
-            CTriangleID ref = FetchTriangle(vrt, pol);
-            if (ref)
+            CPartID part = m_parts[part_of[root]];
+            CFace&  face = *faces[pol];
+            face.part    = part->index;
+            for (auto& tri : face.tris)
             {
-                if (ref->v0->vrt == vrt)
-                    return ref->v0;
-                if (ref->v1->vrt == vrt)
-                    return ref->v1;
-                if (ref->v2->vrt == vrt)
-                    return ref->v2;
+                tri->part = part->index;
+                part->tris.push_back(tri);
+                tri->v0->part = part->index;
+                tri->v1->part = part->index;
+                tri->v2->part = part->index;
             }
         }
-        return nullptr;
     }
 
-    CVerxID AddVertex(LXtPointID vrt, LXtPolygonID pol, CTriangleID tri)
+    //
+    // Classify the topology of the parts from the edge list. An edge used by one triangle of a
+    // part is a border, and an edge of two triangles is consistently oriented when they run it
+    // in opposite directions.
+    //
+    static bool RunsForward(const CTriangle& tri, const CVerx* a, const CVerx* b)
     {
-        if (!pol)
-        {
-            return FetchVertex(vrt);
-        }
-        //printf("AddVertex vrt (%p) pol (%p)", vrt, pol);
-        CTriangleID ref = FetchTriangle(vrt, pol);
-        if (ref)
-        {
-            CVerxID dv = nullptr;
-
-            if (ref->v0->vrt == vrt)
-                dv = ref->v0;
-            if (ref->v1->vrt == vrt)
-                dv = ref->v1;
-            if (ref->v2->vrt == vrt)
-                dv = ref->v2;
-
-            if (dv)
-            {
-                dv->tris.push_back(tri);
-                return dv;
-            }
-        }
-
-        m_vertices.push_back(std::make_shared<CVerx>());
-        CVerxID dv = m_vertices.back();
-
-        dv->tris.push_back(tri);
-        dv->vrt   = vrt;
-        dv->tri   = tri;
-        dv->index = static_cast<unsigned>(m_vertices.size()-1);
-        dv->marks = LXiMARK_ANY;
-        dv->collapsed = false;
-        m_vert.Select(vrt);
-        LXtFVector pos;
-        m_vert.Pos(pos);
-        LXx_VCPY(dv->pos, pos);
-        LXx_VCPY(dv->new_pos, pos);
-        m_vert.Index(&dv->vrt_index);
-        return dv;
+        return (tri.v0.get() == a && tri.v1.get() == b) ||
+               (tri.v1.get() == a && tri.v2.get() == b) ||
+               (tri.v2.get() == a && tri.v0.get() == b);
     }
 
-    // Visitor to build triangles from polygons
-    //
-    class TripleFaceVisitor : public CLxImpl_AbstractVisitor
+    void ClassifyParts()
     {
-    public:
-        LxResult Evaluate()
+        for (auto& edge : m_edges)
         {
-            unsigned nvert;
-            m_poly.VertexCount(&nvert);
-            if (nvert < 3)
-                return LXe_OK;
-
-            m_poly.SetMarks(m_mark_done);
-
-            LXtID4 type;
-            m_poly.Type(&type);
-            if ((type != LXiPTYP_FACE) && (type != LXiPTYP_PSUB) && (type != LXiPTYP_SUBD))
-                return LXe_OK;
-
-            m_context->AddPolygon(m_poly.ID());
-
-            std::vector<LXtPointID> points;
-
-            LXtPointID v0, v1, v2;
-            if (nvert == 3)
+            auto& tris = edge->tris;
+            if (tris.size() == 2 && tris[0]->part == tris[1]->part)
             {
-                m_poly.VertexByIndex(0, &v0);
-                m_poly.VertexByIndex(1, &v1);
-                m_poly.VertexByIndex(2, &v2);
-                m_context->AddTriangle(m_poly.ID(), v0, v1, v2);
+                CPart& part = *m_parts[tris[0]->part];
+                if (RunsForward(*tris[0], edge->v0.get(), edge->v1.get()) == RunsForward(*tris[1], edge->v0.get(), edge->v1.get()))
+                    part.oriented = false;
             }
-            else if (MeshUtil::PolygonFixedVertexList(m_mesh, m_poly, points))
+            else if (tris.size() > 2)
             {
-                bool done = false;
-                if (nvert > 4)
-                {
-                    LXtVector norm;
-                    //MeshUtil::VertexListNormal(m_mesh, points, norm);
-                    m_poly.Normal(norm);
-                    AxisPlane axisPlane(norm);
-                    std::vector<std::vector<LXtPointID>> tris;
-                    CTriangulate ctri(m_mesh);
-                    LxResult result = LXe_OK;
-                    result = ctri.ConstraintDelaunay(axisPlane, points, tris);
-                    if (result == LXe_OK)
-                    {
-                        for (auto& vert : tris)
-                        {
-                            m_context->AddTriangle(m_poly.ID(), vert[0], vert[1], vert[2]);
-                        }
-                        done = true;
-                    }
-                }
-                if (!done)
-                {
-                    v0 = points[0];
-                    for (auto i = 1u; i < points.size()-1; i++)
-                    {
-                        v1 = points[i];
-                        v2 = points[i+1];
-                        m_context->AddTriangle(m_poly.ID(), v0, v1, v2);
-                    }
-                }
+                for (auto& tri : tris)
+                    m_parts[tri->part]->manifold = false;
             }
             else
             {
-                unsigned count;
-                m_poly.GenerateTriangles(&count);
-                for (auto i = 0u; i < count; i++)
-                {
-                    m_poly.TriangleByIndex(i, &v0, &v1, &v2);
-                    m_context->AddTriangle(m_poly.ID(), v0, v1, v2);
-                }
+                // a border, or an edge shared with a hidden or locked part.
+                for (auto& tri : tris)
+                    m_parts[tri->part]->closed = false;
             }
-            return LXe_OK;
         }
+    }
 
-        CLxUser_Mesh    m_mesh;
-        CLxUser_Polygon m_poly;
-        CLxUser_Point   m_vert;
-        LXtMarkMode     m_mark_done;
-        struct CMesh*  m_context;
-    };
-
-    class PartFaceVisitor : public CLxImpl_AbstractVisitor
+    //
+    // Fingerprints of the part. The topology is hashed from the triangles given by the vertex
+    // indices in the part, and the fingerprint adds the positions of the vertices, so they do not
+    // change with the edits of the other parts.
+    //
+    static void Fingerprint(CPart& part)
     {
-    public:
-        LxResult Evaluate()
+        uint64_t hash = 0;
+        auto mix = [&hash](uint64_t key) { hash = MeshUtil::Mix64(hash ^ key); };
+
+        mix(part.vrts.size());
+        mix(part.tris.size());
+
+        // the part vertices are in vertex index order.
+        auto local = [&part](const CVerxID& v) -> uint64_t {
+            auto it = std::lower_bound(part.vrts.begin(), part.vrts.end(), v->index,
+                                       [](const CVerxID& a, unsigned index) { return a->index < index; });
+            if (it == part.vrts.end() || *it != v)
+                return ~0ull;
+            return static_cast<uint64_t>(it - part.vrts.begin());
+        };
+        for (auto& tri : part.tris)
         {
-            CLxUser_LogService   s_log;
-            unsigned nvert;
-            m_poly.VertexCount(&nvert);
-            if (nvert < 3)
-                return LXe_OK;
+            mix(local(tri->v0));
+            mix(local(tri->v1));
+            mix(local(tri->v2));
+        }
+        mix((part.closed ? 1 : 0) | (part.manifold ? 2 : 0) | (part.oriented ? 4 : 0));
+        part.topology = hash;
 
-            LXtID4 type;
-            m_poly.Type(&type);
-            if ((type != LXiPTYP_FACE) && (type != LXiPTYP_PSUB) && (type != LXiPTYP_SUBD))
-                return LXe_OK;
+        for (auto& v : part.vrts)
+        {
+            uint64_t bits[3];
+            std::memcpy(bits, v->pos, sizeof(bits));
+            mix(bits[0]);
+            mix(bits[1]);
+            mix(bits[2]);
+        }
+        part.fingerprint = hash;
+    }
 
-            if (m_poly.TestMarks(m_mark_done) == LXe_TRUE)
-                return LXe_OK;
+    //
+    // Build internal mesh representation
+    //
+    LxResult BuildMesh(CLxUser_Mesh& base_mesh, CThreadPool& pool = CThreadPool::Shared())
+    {
+        LxResult result = Snapshot(base_mesh);
+        if (result != LXe_OK)
+            return result;
+        return BuildMesh(pool);
+    }
 
-            m_context->m_parts.push_back(std::make_shared<CPart>());
-            CPartID part = m_context->m_parts.back();
+    //
+    // Take the snapshot of the mesh, dropping the data of a previous build. This is the only
+    // step of the build calling the SDK.
+    //
+    LxResult Snapshot(CLxUser_Mesh& base_mesh)
+    {
+        Clear();
 
-            part->index = static_cast<unsigned>(m_context->m_parts.size() - 1);
+        m_mesh.set(base_mesh);
+        m_poly.fromMesh(m_mesh);
+        m_vert.fromMesh(m_mesh);
+        m_vmap.fromMesh(m_mesh);
 
-            CLxUser_Polygon poly, poly1;
-            poly.fromMesh(m_mesh);
-            poly1.fromMesh(m_mesh);
-            CLxUser_Edge edge;
-            edge.fromMesh(m_mesh);
+        return m_snapshot.Build(m_mesh);
+    }
 
-            std::vector<LXtPolygonID> stack;
-            LXtPolygonID              pol = m_poly.ID();
-            stack.push_back(pol);
-            m_poly.SetMarks(m_context->m_mark_done);
+    //
+    // Take the mesh and the element IDs of the other mesh, which took a snapshot of the same hash.
+    // The built vertices, triangles and faces are moved over to its point and polygon IDs.
+    //
+    void Rebind(const CMesh& other)
+    {
+        m_mesh.set(other.m_mesh);
+        m_poly.fromMesh(m_mesh);
+        m_vert.fromMesh(m_mesh);
+        m_vmap.fromMesh(m_mesh);
 
-            while (!stack.empty())
-            {
-                pol = stack.back();
-                stack.pop_back();
-                poly.Select(pol);
-                CFace& face = m_context->m_faces[pol];
-                face.part   = part->index;
-                for(auto& tri : face.tris)
-                {
-                    tri->part = part->index;
-                    part->tris.push_back(tri);
-                    tri->v0->part = part->index;
-                    tri->v1->part = part->index;
-                    tri->v2->part = part->index;
-                }
-                unsigned int nvert = 0u, npol = 0u;
-                poly.VertexCount(&nvert);
-                for (auto i = 0u; i < nvert; i++)
-                {
-                    LXtPointID v0{}, v1{};
-                    poly.VertexByIndex(i, &v0);
-                    poly.VertexByIndex((i + 1) % nvert, &v1);
-                    edge.SelectEndpoints(v0, v1);
-                    edge.PolygonCount(&npol);
-                    for (auto j = 0u; j < npol; j++)
-                    {
-                        LXtPolygonID pol1;
-                        edge.PolygonByIndex(j, &pol1);
-                        poly1.Select(pol1);
-                        if (poly1.TestMarks(m_mark_done) == LXe_TRUE)
-                            continue;
-                        poly1.SetMarks(m_mark_done);
-                        if (poly1.TestMarks(m_context->m_mark_hide) == LXe_TRUE)
-                            continue;
-                        if (poly1.TestMarks(m_context->m_mark_lock) == LXe_TRUE)
-                            continue;
-                        stack.push_back(pol1);
-                    }
-                }
-            }
+        std::unordered_map<LXtPolygonID, unsigned> pol_index;
+        for (auto i = 0u; i < m_snapshot.NumPolygons(); i++)
+            pol_index[m_snapshot.m_pol_id[i]] = i;
 
-            return LXe_OK;
-        }
+        m_snapshot.m_point_id = other.m_snapshot.m_point_id;
+        m_snapshot.m_pol_id   = other.m_snapshot.m_pol_id;
 
-        CLxUser_Mesh    m_mesh;
-        CLxUser_Polygon m_poly;
-        CLxUser_Point   m_vert;
-        LXtMarkMode     m_mark_done;
-        struct CMesh*   m_context;
-    };
+        for (auto& v : m_vertices)
+            v->vrt = m_snapshot.m_point_id[v->vrt_index];
+        for (auto& tri : m_triangles)
+            tri->pol = m_snapshot.m_pol_id[tri->pol_index];
+
+        std::unordered_map<LXtPolygonID, CFace> faces;
+        for (auto& face : m_faces)
+            faces[m_snapshot.m_pol_id[pol_index[face.first]]] = std::move(face.second);
+        m_faces.swap(faces);
+    }
 
     //
-    // Build internal mesh representation
+    // Build internal mesh representation from the snapshot on the threads of the pool. This
+    // makes no SDK calls.
     //
-    LxResult BuildMesh(CLxUser_Mesh& base_mesh)
+    LxResult BuildMesh(CThreadPool& pool = CThreadPool::Shared())
     {
-        CLxUser_MeshService mesh_svc;
-        TripleFaceVisitor triFace;
+        m_slots.clear();
+        m_resolver.Reset(m_snapshot);
 
-        m_mesh.set(base_mesh);
-        m_poly.fromMesh(m_mesh);
-        m_vert.fromMesh(m_mesh);
-        m_vmap.fromMesh(m_mesh);
+        // a closed triangle mesh has 3/2 edges per triangle.
+        m_edge_table.Reserve(m_edges.size() + m_snapshot.TriangleCount() * 3 / 2);
 
         // triagulate surface polygons.
-        triFace.m_mesh = m_mesh;
-        triFace.m_poly.fromMesh(m_mesh);
-        triFace.m_vert.fromMesh(m_mesh);
-        triFace.m_mark_done = mesh_svc.ClearMode(LXsMARK_USER_0);
-        triFace.m_context = this;
-        triFace.m_poly.Enum(&triFace, m_pick);
+        TripleFaceVisitor<CMesh> triFace(m_snapshot, this);
+        triFace.Enum(pool);
+        if (m_debug)
+            triFace.m_stats.Print();
 
         // divides polygons into parts.
-        PartFaceVisitor partFace;
-        partFace.m_mesh = m_mesh;
-        partFace.m_poly.fromMesh(m_mesh);
-        partFace.m_vert.fromMesh(m_mesh);
-        partFace.m_mark_done = mesh_svc.SetMode(LXsMARK_USER_0);
-        partFace.m_context = this;
-        partFace.m_poly.Enum(&partFace, m_pick);
+        BuildParts(pool);
+        ClassifyParts();
 
         for (auto& v : m_vertices)
         {
             m_parts[v->part]->vrts.push_back(v);
         }
-        printf("Build mesh with %zu vertices %zu triangles %zu parts\n", m_vertices.size(), m_triangles.size(), m_parts.size());
+
+        // a vertex shared by two parts would be dropped from one of them.
+        unsigned shared = 0;
+        for (auto& tri : m_triangles)
+        {
+            if (tri->v0->part != tri->part || tri->v1->part != tri->part || tri->v2->part != tri->part)
+                shared ++;
+        }
+        if (shared)
+            std::cerr << "warning: " << shared << " triangles have vertices in another part\n";
+
+        ParallelFor(pool, 0u, static_cast<unsigned>(m_parts.size()), 1u, [&](unsigned begin, unsigned end) {
+            for (auto i = begin; i < end; i++)
+                Fingerprint(*m_parts[i]);
+        });
+        std::vector<CVerxID>().swap(m_slots);
+        if (m_debug)
+            printf("Build mesh with %zu vertices %zu triangles %zu parts (%.1f bytes/triangle, %zu bytes in snapshot, %lu SDK calls in snapshot)\n", m_vertices.size(), m_triangles.size(), m_parts.size(), BytesPerTriangle(), m_snapshot.MemoryUsage(), m_snapshot.m_sdk_calls);
         return LXe_OK;
     }
 
@@ -579,14 +737,30 @@ struct CMesh
 
     CEdgeID FetchEdge(CVerxID v0, CVerxID v1)
     {
-        for (auto& edge : v0->edge)
+        unsigned index = m_edge_table.Find(v0->index, v1->index);
+        if (index == CEdgeTable::npos)
+            return nullptr;
+        return m_edges[index];
+    }
+
+    //
+    // Move the end of the edge from the collapsed vertex to the kept vertex and update the edge
+    // table. The edge is marked collapsed when the kept vertex already has the same edge.
+    //
+    bool RelinkEdge(CEdgeID edge, CVerxID gone, CVerxID keep)
+    {
+        m_edge_table.Erase(edge->v0->index, edge->v1->index, edge->index);
+        if (edge->v0 == gone)
+            edge->v0 = keep;
+        if (edge->v1 == gone)
+            edge->v1 = keep;
+        if (m_edge_table.Find(edge->v0->index, edge->v1->index) != CEdgeTable::npos)
         {
-            if ((edge->v0 == v0 && edge->v1 == v1) || (edge->v0 == v1 && edge->v1 == v0))
-            {
-                return edge;
-            }
+            edge->collapsed = true;
+            return false;
         }
-        return nullptr;
+        m_edge_table.Insert(edge->v0->index, edge->v1->index, edge->index);
+        return true;
     }
 
     //
@@ -618,14 +792,9 @@ struct CMesh
             }
             for (auto& edge : v1->edge)
             {
-                if (edge->v0 == v1)
-                    edge->v0 = v0;
-                if (edge->v1 == v1)
-                    edge->v1 = v0;
-                CEdgeID edge1 = FetchEdge(edge->v0, edge->v1);
-                if (edge1 != nullptr && edge1 != edge)
-                    edge->collapsed = true;
-                else
+                if (edge->collapsed || edge == target_edge)
+                    continue;
+                if (RelinkEdge(edge, v1, v0))
                     v0->edge.push_back(edge);
             }
             v1->collapsed = true;
@@ -646,18 +815,14 @@ struct CMesh
             }
             for (auto& edge : v0->edge)
             {
-                if (edge->v0 == v0)
-                    edge->v0 = v1;
-                if (edge->v1 == v0)
-                    edge->v1 = v1;
-                CEdgeID edge1 = FetchEdge(edge->v0, edge->v1);
-                if (edge1 != nullptr && edge1 != edge)
-                    edge->collapsed = true;
-                else
+                if (edge->collapsed || edge == target_edge)
+                    continue;
+                if (RelinkEdge(edge, v0, v1))
                     v1->edge.push_back(edge);
             }
             v0->collapsed = true;
         }
+        m_edge_table.Erase(v0->index, v1->index, target_edge->index);
         target_edge->collapsed = true;
         for (auto& tri : target_edge->tris)
         {
@@ -801,13 +966,45 @@ struct CMesh
         return LXe_OK;
     }
 
+    //
+    // Estimate heap bytes held by the node graph. Each make_shared node carries a control block
+    // (two counters and a vtable pointer) in front of the object.
+    //
+    size_t MemoryUsage() const
+    {
+        const size_t block = 2 * sizeof(long) + sizeof(void*);
+        const size_t ref   = sizeof(CVerxID);
+
+        size_t bytes = (m_vertices.capacity() + m_edges.capacity() + m_triangles.capacity() + m_parts.capacity()) * ref;
+        for (auto& v : m_vertices)
+            bytes += block + sizeof(CVerx) + (v->edge.capacity() + v->tris.capacity()) * ref;
+        for (auto& e : m_edges)
+            bytes += block + sizeof(CEdge) + e->tris.capacity() * ref;
+        bytes += m_triangles.size() * (block + sizeof(CTriangle));
+        for (auto& part : m_parts)
+            bytes += block + sizeof(CPart) + (part->tris.capacity() + part->vrts.capacity()) * ref;
+        for (auto& face : m_faces)
+            bytes += sizeof(void*) * 2 + sizeof(face) + face.second.tris.capacity() * ref;
+        bytes += m_faces.bucket_count() * sizeof(void*);
+        return bytes;
+    }
+
+    double BytesPerTriangle() const
+    {
+        if (m_triangles.empty())
+            return 0.0;
+        return static_cast<double>(MemoryUsage()) / static_cast<double>(m_triangles.size());
+    }
+
     void Clear()
     {
         m_vertices.clear();
         m_edges.clear();
+        m_edge_table.Clear();
         m_triangles.clear();
         m_faces.clear();
         m_parts.clear();
+        m_snapshot.Clear();
     }
 
     LxResult Remove(CLxUser_Mesh& edit_mesh)
@@ -863,6 +1060,11 @@ struct CMesh
 
     std::unordered_map<LXtPolygonID, CFace> m_faces;
 
+    CEdgeTable           m_edge_table;
+    CMeshSnapshot        m_snapshot;
+    CVerxResolver        m_resolver;
+    std::vector<CVerxID> m_slots;      // vertex of each resolver slot while building
+
     CLxUser_Mesh        m_mesh;
     CLxUser_Edge        m_edge;
     CLxUser_Polygon     m_poly;
@@ -877,4 +1079,6 @@ struct CMesh
     LXtMarkMode m_mark_seam;
     LXtMarkMode m_mark_hide;
     LXtMarkMode m_mark_lock;
+
+    int m_debug;    // print the build statistics
 };
@@ -0,0 +1,232 @@
+//
+// Flat Mesh Context from Modo.
+// This is an index based alternative to CMesh. Vertices, edges, triangles, faces and parts are
+// stored in parallel arrays, and the adjacency between them is stored in CSR form (an offset
+// array and an index array). There is no per element heap allocation. The layout is built from
+// a built CMesh, so both layouts hold the same vertices, triangles and part and proxy labels, and
+// their memory usage can be compared.
+//
+#pragma once
+
+#include <lxsdk/lx_mesh.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "cmesh.hpp"
+
+struct CFlatMesh
+{
+    unsigned NumVertices() const  { return static_cast<unsigned>(m_vrt.size()); }
+    unsigned NumEdges() const     { return static_cast<unsigned>(m_edge_tri_offset.empty() ? 0u : m_edge_tri_offset.size() - 1); }
+    unsigned NumTriangles() const { return static_cast<unsigned>(m_tpart.size()); }
+    unsigned NumFaces() const     { return static_cast<unsigned>(m_face_pol.size()); }
+    unsigned NumParts() const     { return m_part_tri_offset.empty() ? 0u : static_cast<unsigned>(m_part_tri_offset.size() - 1); }
+
+    //
+    // Build from the vertices and triangles of CMesh. The triangles of a source polygon are
+    // listed together in CMesh, and the parts and proxies are taken from their labels.
+    //
+    LxResult BuildMesh(const CMesh& cmesh)
+    {
+        Clear();
+
+        auto nvrt = cmesh.m_vertices.size();
+        m_vrt.resize(nvrt);
+        m_vrt_index.resize(nvrt);
+        m_pos.resize(nvrt * 3);
+        m_vpart.resize(nvrt);
+        for (auto& v : cmesh.m_vertices)
+        {
+            m_vrt[v->index]       = v->vrt;
+            m_vrt_index[v->index] = v->vrt_index;
+            m_vpart[v->index]     = v->part;
+            for (auto k = 0u; k < 3; k++)
+                m_pos[v->index * 3 + k] = static_cast<float>(v->pos[k]);
+        }
+
+        auto ntri = cmesh.m_triangles.size();
+        m_tris.reserve(ntri * 3);
+        m_tface.reserve(ntri);
+        m_tpart.reserve(ntri);
+        m_tproxy.reserve(ntri);
+        for (auto& tri : cmesh.m_triangles)
+        {
+            if (m_face_index.empty() || m_face_index.back() != static_cast<uint32_t>(tri->pol_index))
+            {
+                m_face_pol.push_back(tri->pol);
+                m_face_index.push_back(static_cast<uint32_t>(tri->pol_index));
+                m_face_tri_offset.push_back(NumTriangles());
+                m_face_part.push_back(tri->part);
+            }
+            m_tris.push_back(tri->v0->index);
+            m_tris.push_back(tri->v1->index);
+            m_tris.push_back(tri->v2->index);
+            m_tface.push_back(NumFaces() - 1);
+            m_tpart.push_back(tri->part);
+            m_tproxy.push_back(tri->proxy);
+        }
+        m_face_tri_offset.push_back(NumTriangles());
+
+        BuildEdges();
+        MakeLinks(NumVertices(), m_tris, 3, m_vert_tri_offset, m_vert_tri);
+        MakeLinks(NumVertices(), m_edges, 2, m_vert_edge_offset, m_vert_edge);
+
+        auto nparts = static_cast<unsigned>(cmesh.m_parts.size());
+        MakeLinks(nparts, m_tpart, 1, m_part_tri_offset, m_part_tri);
+        MakeLinks(nparts, m_vpart, 1, m_part_vrt_offset, m_part_vrt);
+        return LXe_OK;
+    }
+
+    //
+    // Make unique edges from triangle sides and the edge to triangle links.
+    //
+    void BuildEdges()
+    {
+        auto ntri = NumTriangles();
+
+        std::vector<std::pair<uint64_t,uint32_t>> sides(ntri * 3);
+        for (auto t = 0u; t < ntri; t++)
+        {
+            for (auto k = 0u; k < 3; k++)
+            {
+                uint64_t a = m_tris[t * 3 + k];
+                uint64_t b = m_tris[t * 3 + (k + 1) % 3];
+                sides[t * 3 + k] = std::make_pair(std::min(a, b) << 32 | std::max(a, b), t * 3 + k);
+            }
+        }
+        std::sort(sides.begin(), sides.end());
+
+        for (auto i = 0u; i < sides.size(); i++)
+        {
+            if (i == 0 || sides[i].first != sides[i - 1].first)
+            {
+                // keep the direction of the first triangle side like CMesh::AddEdge
+                auto c = sides[i].second;
+                m_edges.push_back(m_tris[c]);
+                m_edges.push_back(m_tris[c - c % 3 + (c % 3 + 1) % 3]);
+                m_edge_tri_offset.push_back(i);
+            }
+            m_edge_tri.push_back(sides[i].second / 3);
+        }
+        m_edge_tri_offset.push_back(static_cast<uint32_t>(sides.size()));
+    }
+
+    static void MakeLinks(unsigned count, const std::vector<uint32_t>& elements, unsigned stride, std::vector<uint32_t>& offset, std::vector<uint32_t>& links)
+    {
+        offset.assign(count + 1, 0);
+        for (auto v : elements)
+            offset[v + 1] ++;
+        for (auto i = 0u; i < count; i++)
+            offset[i + 1] += offset[i];
+        links.resize(elements.size());
+        std::vector<uint32_t> fill(offset.begin(), offset.end() - 1);
+        for (auto i = 0u; i < elements.size(); i++)
+            links[fill[elements[i]] ++] = i / stride;
+    }
+
+    //
+    // Segmentation queries used for polygon tags and edge selection sets.
+    //
+    unsigned FaceProxy(unsigned f) const
+    {
+        return m_tproxy[m_face_tri_offset[f]];
+    }
+
+    bool EdgeIsSeam(unsigned e) const
+    {
+        if (m_edge_tri_offset[e + 1] - m_edge_tri_offset[e] != 2)
+            return false;
+        return m_tproxy[m_edge_tri[m_edge_tri_offset[e]]] != m_tproxy[m_edge_tri[m_edge_tri_offset[e] + 1]];
+    }
+
+    unsigned NumSeams() const
+    {
+        unsigned count = 0;
+        for (auto e = 0u; e < NumEdges(); e++)
+        {
+            if (EdgeIsSeam(e))
+                count ++;
+        }
+        return count;
+    }
+
+    template <typename T>
+    static size_t Bytes(const std::vector<T>& v)
+    {
+        return v.capacity() * sizeof(T);
+    }
+
+    size_t MemoryUsage() const
+    {
+        return Bytes(m_vrt) + Bytes(m_vrt_index) + Bytes(m_pos) + Bytes(m_vpart) +
+               Bytes(m_tris) + Bytes(m_tface) + Bytes(m_tpart) + Bytes(m_tproxy) +
+               Bytes(m_edges) + Bytes(m_edge_tri_offset) + Bytes(m_edge_tri) +
+               Bytes(m_face_pol) + Bytes(m_face_index) + Bytes(m_face_tri_offset) + Bytes(m_face_part) +
+               Bytes(m_vert_tri_offset) + Bytes(m_vert_tri) + Bytes(m_vert_edge_offset) + Bytes(m_vert_edge) +
+               Bytes(m_part_tri_offset) + Bytes(m_part_tri) + Bytes(m_part_vrt_offset) + Bytes(m_part_vrt);
+    }
+
+    double BytesPerTriangle() const
+    {
+        if (!NumTriangles())
+            return 0.0;
+        return static_cast<double>(MemoryUsage()) / static_cast<double>(NumTriangles());
+    }
+
+    void Clear()
+    {
+        m_vrt.clear();
+        m_vrt_index.clear();
+        m_pos.clear();
+        m_vpart.clear();
+        m_tris.clear();
+        m_tface.clear();
+        m_tpart.clear();
+        m_tproxy.clear();
+        m_edges.clear();
+        m_edge_tri_offset.clear();
+        m_edge_tri.clear();
+        m_face_pol.clear();
+        m_face_index.clear();
+        m_face_tri_offset.clear();
+        m_face_part.clear();
+        m_vert_tri_offset.clear();
+        m_vert_tri.clear();
+        m_vert_edge_offset.clear();
+        m_vert_edge.clear();
+        m_part_tri_offset.clear();
+        m_part_tri.clear();
+        m_part_vrt_offset.clear();
+        m_part_vrt.clear();
+    }
+
+    // vertices
+    std::vector<LXtPointID> m_vrt;          // source point
+    std::vector<uint32_t>   m_vrt_index;    // source point index
+    std::vector<float>      m_pos;          // vertex positions (xyz)
+    std::vector<uint32_t>   m_vpart;        // part index
+
+    // triangles
+    std::vector<uint32_t>   m_tris;         // vertex index triples
+    std::vector<uint32_t>   m_tface;        // source face index
+    std::vector<uint32_t>   m_tpart;        // part index
+    std::vector<uint32_t>   m_tproxy;       // proxy index
+
+    // edges
+    std::vector<uint32_t>   m_edges;        // vertex index pairs
+    std::vector<uint32_t>   m_edge_tri_offset, m_edge_tri;
+
+    // faces (source polygons). Triangles of a face are contiguous.
+    std::vector<LXtPolygonID> m_face_pol;
+    std::vector<uint32_t>     m_face_index;     // snapshot polygon index
+    std::vector<uint32_t>     m_face_tri_offset;
+    std::vector<uint32_t>     m_face_part;
+
+    // vertex and part links
+    std::vector<uint32_t>   m_vert_tri_offset, m_vert_tri;
+    std::vector<uint32_t>   m_vert_edge_offset, m_vert_edge;
+    std::vector<uint32_t>   m_part_tri_offset, m_part_tri;
+    std::vector<uint32_t>   m_part_vrt_offset, m_part_vrt;
+};
@@ -0,0 +1,282 @@
+//
+// Thread pool and parallel helpers for the mesh stages.
+// The stages after the mesh snapshot make no SDK calls, so they can run on these threads.
+//
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+//
+// Thread pool with a shared task queue. The thread waiting on a task group runs pending tasks
+// too, so task groups can be nested without dead locks.
+//
+// The workers share the queue state with the pool and are detached. Deleting the pool sets the
+// stop flag, and the workers run the tasks left and exit on their own, so the static pools are
+// never joined in static destructors while the module is unloaded.
+//
+class CThreadPool
+{
+public:
+    CThreadPool(unsigned nthreads = 0) : m_state(std::make_shared<State>())
+    {
+        if (nthreads == 0)
+            nthreads = std::max(1u, std::thread::hardware_concurrency());
+        m_nthreads = nthreads;
+        // the waiting thread is the last worker.
+        for (auto i = 1u; i < nthreads; i++)
+        {
+            std::shared_ptr<State> state = m_state;
+            std::thread([state]() { Worker(*state); }).detach();
+        }
+    }
+
+    ~CThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            m_state->stop = true;
+        }
+        m_state->cond.notify_all();
+    }
+
+    static CThreadPool& Shared()
+    {
+        static CThreadPool pool;
+        return pool;
+    }
+
+    //
+    // Shared pool of the given number of threads, or the default pool for 0. The pools are kept,
+    // so the evaluations with the same number of threads run on the same threads.
+    //
+    static CThreadPool& Shared(unsigned nthreads)
+    {
+        if (nthreads == 0)
+            return Shared();
+        static std::mutex mutex;
+        static std::unordered_map<unsigned, std::unique_ptr<CThreadPool>> pools;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& pool = pools[nthreads];
+        if (!pool)
+            pool.reset(new CThreadPool(nthreads));
+        return *pool;
+    }
+
+    unsigned NumThreads() const
+    {
+        return m_nthreads;
+    }
+
+    void Push(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            m_state->tasks.push_back(std::move(task));
+        }
+        m_state->cond.notify_one();
+    }
+
+    //
+    // Run a pending task on the calling thread. Return false if there is no task.
+    //
+    bool RunOne()
+    {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> lock(m_state->mutex);
+            if (m_state->tasks.empty())
+                return false;
+            task = std::move(m_state->tasks.front());
+            m_state->tasks.pop_front();
+        }
+        task();
+        return true;
+    }
+
+private:
+    struct State
+    {
+        std::deque<std::function<void()>> tasks;
+        std::mutex                        mutex;
+        std::condition_variable           cond;
+        bool                              stop = false;
+    };
+
+    static void Worker(State& state)
+    {
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(state.mutex);
+                state.cond.wait(lock, [&state]() { return state.stop || !state.tasks.empty(); });
+                if (state.stop && state.tasks.empty())
+                    return;
+                task = std::move(state.tasks.front());
+                state.tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::shared_ptr<State> m_state;
+    unsigned               m_nthreads;
+};
+
+//
+// Group of tasks to wait for. The first exception thrown by a task is thrown again from Wait().
+//
+class CTaskGroup
+{
+public:
+    CTaskGroup(CThreadPool& pool = CThreadPool::Shared()) : m_pool(pool) {}
+
+    ~CTaskGroup()
+    {
+        try
+        {
+            Wait();
+        }
+        catch(...)
+        {
+        }
+    }
+
+    template <typename F>
+    void Run(F func)
+    {
+        m_pending ++;
+        m_pool.Push([this, func]() {
+            try
+            {
+                func();
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error)
+                    m_error = std::current_exception();
+            }
+            // The last task notifies under the lock, so Wait() cannot return and destroy the
+            // group before the task is done with it.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (-- m_pending == 0)
+                m_cond.notify_all();
+        });
+    }
+
+    //
+    // Run the queued tasks on the calling thread, and sleep once the tasks left are running.
+    //
+    void Wait()
+    {
+        while (m_pending && m_pool.RunOne())
+            ;
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this]() { return m_pending == 0; });
+            std::swap(error, m_error);
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    CThreadPool&            m_pool;
+    std::atomic<unsigned>   m_pending{0};
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    std::exception_ptr      m_error;
+};
+
+//
+// Call func(begin, end) over chunks of the index range on the given thread pool. Small ranges run
+// on the calling thread.
+//
+template <typename F>
+static void ParallelFor(CThreadPool& pool, unsigned begin, unsigned end, unsigned grain, F func)
+{
+    if (end <= begin)
+        return;
+    if (grain == 0)
+        grain = 1;
+    if (pool.NumThreads() == 1 || end - begin <= grain)
+    {
+        func(begin, end);
+        return;
+    }
+
+    // a few chunks per thread to balance the load.
+    unsigned chunk = std::max(grain, (end - begin + pool.NumThreads() * 4 - 1) / (pool.NumThreads() * 4));
+
+    CTaskGroup group(pool);
+    for (auto i = begin; i < end; i += chunk)
+    {
+        auto j = std::min(end, i + chunk);
+        group.Run([&func, i, j]() { func(i, j); });
+    }
+    group.Wait();
+}
+
+//
+// Concurrent union-find. Roots are always linked to the smaller index, so the root of a set is
+// its smallest element and Union() can be called from several threads.
+//
+class CUnionFind
+{
+public:
+    CUnionFind(unsigned n) : m_parent(new std::atomic<unsigned>[n]), m_size(n)
+    {
+        for (auto i = 0u; i < n; i++)
+            m_parent[i].store(i, std::memory_order_relaxed);
+    }
+
+    unsigned Size() const { return m_size; }
+
+    unsigned Find(unsigned i)
+    {
+        while (true)
+        {
+            unsigned p = m_parent[i].load(std::memory_order_relaxed);
+            if (p == i)
+                return i;
+            unsigned g = m_parent[p].load(std::memory_order_relaxed);
+            // path halving
+            if (g != p)
+                m_parent[i].compare_exchange_weak(p, g, std::memory_order_relaxed);
+            i = g;
+        }
+    }
+
+    void Union(unsigned a, unsigned b)
+    {
+        while (true)
+        {
+            a = Find(a);
+            b = Find(b);
+            if (a == b)
+                return;
+            if (a < b)
+                std::swap(a, b);
+            unsigned expected = a;
+            if (m_parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+                return;
+        }
+    }
+
+private:
+    std::unique_ptr<std::atomic<unsigned>[]> m_parent;
+    unsigned                                 m_size;
+};
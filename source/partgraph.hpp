@@ -0,0 +1,608 @@
+//
+// Halfedge graph of a CMesh part for CGAL algorithms.
+// This models CGAL HalfedgeListGraph and FaceListGraph through boost::graph_traits, so the
+// Variational Shape Approximation runs on the part without a Surface_mesh. It is not a zero
+// copy view: CMesh has no halfedges, so the connectivity is copied once into flat index
+// arrays. The vertex points are still read from the CVerx of the part.
+//
+#pragma once
+
+#include <boost/graph/graph_traits.hpp>
+#include <boost/iterator/counting_iterator.hpp>
+#include <boost/property_map/property_map.hpp>
+
+#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
+#include <CGAL/boost/graph/properties.h>
+#include <CGAL/Iterator_range.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+
+#include "cmesh.hpp"
+
+typedef CGAL::Exact_predicates_inexact_constructions_kernel::Point_3 CPartPoint;
+
+//
+// Index descriptor of the part graph. The tag keeps vertices, halfedges, edges and faces apart.
+//
+template <typename Tag>
+struct CPartIndex
+{
+    CPartIndex() : idx(~0u) {}
+    explicit CPartIndex(std::size_t i) : idx(static_cast<unsigned>(i)) {}
+
+    operator std::size_t() const { return idx; }
+
+    bool operator==(const CPartIndex& other) const { return idx == other.idx; }
+    bool operator!=(const CPartIndex& other) const { return idx != other.idx; }
+    bool operator<(const CPartIndex& other) const  { return idx < other.idx; }
+
+    CPartIndex& operator++()                { idx ++; return *this; }
+    CPartIndex& operator--()                { idx --; return *this; }
+    CPartIndex& operator+=(std::ptrdiff_t n) { idx = static_cast<unsigned>(idx + n); return *this; }
+    std::ptrdiff_t operator-(const CPartIndex& other) const
+    {
+        return static_cast<std::ptrdiff_t>(idx) - static_cast<std::ptrdiff_t>(other.idx);
+    }
+
+    friend std::size_t hash_value(const CPartIndex& i) { return i.idx; }
+
+    unsigned idx;
+};
+
+struct CPartVertexTag {};
+struct CPartHalfedgeTag {};
+struct CPartEdgeTag {};
+struct CPartFaceTag {};
+
+namespace std {
+template <typename Tag>
+struct hash<CPartIndex<Tag>>
+{
+    std::size_t operator()(const CPartIndex<Tag>& i) const { return i.idx; }
+};
+}
+
+struct CPartTraversalCategory : public virtual boost::bidirectional_graph_tag,
+                                public virtual boost::vertex_list_graph_tag,
+                                public virtual boost::edge_list_graph_tag
+{
+};
+
+//
+// Halfedges of an edge e are 2e and 2e+1 like Surface_mesh, so the opposite is h ^ 1. The
+// halfedges of a face f are the triangle edges in the corner order of part->tris[f], so face
+// descriptors are the triangle indices of the part.
+//
+class CPartGraph
+{
+public:
+    typedef CPartIndex<CPartVertexTag>   vertex_descriptor;
+    typedef CPartIndex<CPartHalfedgeTag> halfedge_descriptor;
+    typedef CPartIndex<CPartEdgeTag>     edge_descriptor;
+    typedef CPartIndex<CPartFaceTag>     face_descriptor;
+
+    static constexpr unsigned null = ~0u;
+
+    //
+    // Make the halfedges of the part. This fails on parts Surface_mesh cannot hold either:
+    // non-manifold edges or vertices and inconsistently oriented triangles. Closed parts are
+    // oriented to bound a volume like PMP::orient_to_bound_a_volume().
+    //
+    LxResult Build(const CPart& part)
+    {
+        if (Make(part, false) != LXe_OK)
+            return LXe_FAILED;
+        if (m_nborder == 0 && SignedVolume() < 0.0)
+            return Make(part, true);
+        return LXe_OK;
+    }
+
+    unsigned NumVertices() const  { return static_cast<unsigned>(m_verts.size()); }
+    unsigned NumHalfedges() const { return static_cast<unsigned>(m_target.size()); }
+    unsigned NumEdges() const     { return NumHalfedges() / 2; }
+    unsigned NumFaces() const     { return static_cast<unsigned>(m_face_he.size()); }
+
+    const double* Position(unsigned v) const
+    {
+        return m_verts[v]->pos;
+    }
+
+    CPartPoint Point(unsigned v) const
+    {
+        const double* pos = m_verts[v]->pos;
+        return CPartPoint(pos[0], pos[1], pos[2]);
+    }
+
+    template <typename T>
+    static size_t Bytes(const std::vector<T>& v)
+    {
+        return v.capacity() * sizeof(T);
+    }
+
+    size_t MemoryUsage() const
+    {
+        return Bytes(m_verts) + Bytes(m_global) + Bytes(m_vertex_he) + Bytes(m_face_he) +
+               Bytes(m_target) + Bytes(m_next) + Bytes(m_prev) + Bytes(m_face);
+    }
+
+    std::vector<const CVerx*> m_verts;      // part vertices
+    std::vector<unsigned>     m_global;     // CMesh vertex index of the part vertices
+    std::vector<unsigned>     m_vertex_he;  // a halfedge into the vertex, a border one if any
+    std::vector<unsigned>     m_face_he;    // first halfedge of the face
+    std::vector<unsigned>     m_target, m_next, m_prev, m_face;
+    unsigned                  m_nborder = 0;
+
+private:
+    LxResult Make(const CPart& part, bool flip)
+    {
+        auto nvert = static_cast<unsigned>(part.vrts.size());
+        auto nface = static_cast<unsigned>(part.tris.size());
+
+        // part vertices are listed in CMesh vertex order, so the local index is a binary search.
+        m_verts.resize(nvert);
+        m_global.resize(nvert);
+        for (auto i = 0u; i < nvert; i++)
+        {
+            m_verts[i]  = part.vrts[i].get();
+            m_global[i] = part.vrts[i]->index;
+            if (i > 0 && m_global[i] <= m_global[i - 1])
+                return LXe_FAILED;
+        }
+
+        std::vector<unsigned> corner(nface * 3);
+        for (auto f = 0u; f < nface; f++)
+        {
+            const CTriangle& tri = *part.tris[f];
+            const CVerx*     v[3] = {tri.v0.get(), tri.v1.get(), tri.v2.get()};
+            if (flip)
+                std::swap(v[1], v[2]);
+            for (auto k = 0u; k < 3; k++)
+            {
+                auto it = std::lower_bound(m_global.begin(), m_global.end(), v[k]->index);
+                if (it == m_global.end() || *it != v[k]->index)
+                    return LXe_FAILED;
+                corner[f * 3 + k] = static_cast<unsigned>(it - m_global.begin());
+            }
+            if (corner[f * 3] == corner[f * 3 + 1] || corner[f * 3 + 1] == corner[f * 3 + 2] || corner[f * 3 + 2] == corner[f * 3])
+                return LXe_FAILED;
+        }
+
+        // sort the triangle edges by their end points to pair them into edges.
+        std::vector<std::pair<uint64_t,unsigned>> keys(nface * 3);
+        for (auto c = 0u; c < nface * 3; c++)
+        {
+            uint64_t s = corner[c];
+            uint64_t t = corner[c - c % 3 + (c + 1) % 3];
+            keys[c] = std::make_pair((std::min(s, t) << 32) | std::max(s, t), c);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        unsigned nedge = 0;
+        for (auto i = 0u; i < keys.size(); i++)
+        {
+            if (i == 0 || keys[i].first != keys[i - 1].first)
+                nedge ++;
+        }
+
+        m_target.assign(nedge * 2, null);
+        m_next.assign(nedge * 2, null);
+        m_prev.assign(nedge * 2, null);
+        m_face.assign(nedge * 2, null);
+        m_face_he.assign(nface, null);
+
+        std::vector<unsigned> corner_he(nface * 3);
+        unsigned e = 0;
+        for (auto i = 0u; i < keys.size(); e++)
+        {
+            auto j = i;
+            while (j < keys.size() && keys[j].first == keys[i].first)
+                j ++;
+            if (j - i > 2)
+                return LXe_FAILED;
+
+            unsigned a = static_cast<unsigned>(keys[i].first >> 32);
+            unsigned b = static_cast<unsigned>(keys[i].first & 0xffffffff);
+            m_target[e * 2]     = b;
+            m_target[e * 2 + 1] = a;
+            for (; i < j; i++)
+            {
+                auto c = keys[i].second;
+                auto h = (corner[c] == a) ? e * 2 : e * 2 + 1;
+                // two triangles running the edge the same way
+                if (m_face[h] != null)
+                    return LXe_FAILED;
+                m_face[h]    = c / 3;
+                corner_he[c] = h;
+            }
+        }
+
+        for (auto f = 0u; f < nface; f++)
+        {
+            for (auto k = 0u; k < 3; k++)
+            {
+                auto h = corner_he[f * 3 + k];
+                auto n = corner_he[f * 3 + (k + 1) % 3];
+                m_next[h] = n;
+                m_prev[n] = h;
+            }
+            m_face_he[f] = corner_he[f * 3];
+        }
+
+        // link the border halfedges. A vertex with two border fans is not manifold.
+        std::vector<unsigned> out_border(nvert, null);
+        m_nborder = 0;
+        for (auto h = 0u; h < nedge * 2; h++)
+        {
+            if (m_face[h] != null)
+                continue;
+            auto source = m_target[h ^ 1];
+            if (out_border[source] != null)
+                return LXe_FAILED;
+            out_border[source] = h;
+            m_nborder ++;
+        }
+        for (auto h = 0u; h < nedge * 2; h++)
+        {
+            if (m_face[h] != null)
+                continue;
+            auto n = out_border[m_target[h]];
+            m_next[h] = n;
+            m_prev[n] = h;
+        }
+
+        std::vector<unsigned> degree(nvert, 0);
+        m_vertex_he.assign(nvert, null);
+        for (auto h = 0u; h < nedge * 2; h++)
+        {
+            auto v = m_target[h];
+            degree[v] ++;
+            if (m_vertex_he[v] == null || m_face[h] == null)
+                m_vertex_he[v] = h;
+        }
+
+        // every halfedge into a vertex must be reached around it, or the vertex is pinched.
+        for (auto v = 0u; v < nvert; v++)
+        {
+            auto h0 = m_vertex_he[v];
+            if (h0 == null)
+                continue;
+            unsigned count = 0;
+            auto     h     = h0;
+            do
+            {
+                count ++;
+                h = m_next[h] ^ 1;
+            } while (h != h0 && count <= degree[v]);
+            if (count != degree[v])
+                return LXe_FAILED;
+        }
+        return LXe_OK;
+    }
+
+    double SignedVolume() const
+    {
+        double volume = 0.0;
+        for (auto f = 0u; f < NumFaces(); f++)
+        {
+            auto h0 = m_face_he[f];
+            auto h1 = m_next[h0];
+            const double* a = m_verts[m_target[m_prev[h0]]]->pos;
+            const double* b = m_verts[m_target[h0]]->pos;
+            const double* c = m_verts[m_target[h1]]->pos;
+            volume += a[0] * (b[1] * c[2] - b[2] * c[1]) +
+                      a[1] * (b[2] * c[0] - b[0] * c[2]) +
+                      a[2] * (b[0] * c[1] - b[1] * c[0]);
+        }
+        return volume;
+    }
+};
+
+//
+// Property maps of the part graph. The point map builds the point type of the kernel the
+// algorithm runs on from the vertex positions.
+//
+template <typename Point = CPartPoint>
+struct CPartPointMap
+{
+    typedef CPartGraph::vertex_descriptor key_type;
+    typedef Point                         value_type;
+    typedef Point                         reference;
+    typedef boost::readable_property_map_tag category;
+
+    CPartPointMap(const CPartGraph* graph = nullptr) : m_graph(graph) {}
+
+    friend Point get(const CPartPointMap& map, key_type v)
+    {
+        const double* pos = map.m_graph->Position(v.idx);
+        return Point(pos[0], pos[1], pos[2]);
+    }
+
+    const CPartGraph* m_graph;
+};
+
+template <typename Descriptor>
+struct CPartIndexMap
+{
+    typedef Descriptor  key_type;
+    typedef std::size_t value_type;
+    typedef std::size_t reference;
+    typedef boost::readable_property_map_tag category;
+
+    friend std::size_t get(const CPartIndexMap&, key_type d) { return d.idx; }
+};
+
+//
+// Read/write map of a value per face, e.g. the proxy of each face for the segmentation.
+//
+template <typename T>
+struct CPartFaceMap
+{
+    typedef CPartGraph::face_descriptor key_type;
+    typedef T                           value_type;
+    typedef T&                          reference;
+    typedef boost::lvalue_property_map_tag category;
+
+    CPartFaceMap(std::vector<T>* values = nullptr) : m_values(values) {}
+
+    T& operator[](key_type f) const { return (*m_values)[f.idx]; }
+
+    friend T& get(const CPartFaceMap& map, key_type f)             { return (*map.m_values)[f.idx]; }
+    friend void put(const CPartFaceMap& map, key_type f, const T& v) { (*map.m_values)[f.idx] = v; }
+
+    std::vector<T>* m_values;
+};
+
+namespace boost {
+
+template <>
+struct graph_traits<CPartGraph>
+{
+    typedef CPartGraph::vertex_descriptor   vertex_descriptor;
+    typedef CPartGraph::halfedge_descriptor halfedge_descriptor;
+    typedef CPartGraph::edge_descriptor     edge_descriptor;
+    typedef CPartGraph::face_descriptor     face_descriptor;
+
+    typedef boost::counting_iterator<vertex_descriptor, std::random_access_iterator_tag, std::ptrdiff_t>   vertex_iterator;
+    typedef boost::counting_iterator<halfedge_descriptor, std::random_access_iterator_tag, std::ptrdiff_t> halfedge_iterator;
+    typedef boost::counting_iterator<edge_descriptor, std::random_access_iterator_tag, std::ptrdiff_t>     edge_iterator;
+    typedef boost::counting_iterator<face_descriptor, std::random_access_iterator_tag, std::ptrdiff_t>     face_iterator;
+
+    typedef boost::undirected_tag           directed_category;
+    typedef boost::disallow_parallel_edge_tag edge_parallel_category;
+    typedef CPartTraversalCategory          traversal_category;
+
+    typedef std::size_t vertices_size_type;
+    typedef std::size_t halfedges_size_type;
+    typedef std::size_t edges_size_type;
+    typedef std::size_t faces_size_type;
+    typedef std::size_t degree_size_type;
+
+    static vertex_descriptor   null_vertex()   { return vertex_descriptor(); }
+    static halfedge_descriptor null_halfedge() { return halfedge_descriptor(); }
+    static face_descriptor     null_face()     { return face_descriptor(); }
+};
+
+template <>
+struct graph_traits<const CPartGraph> : public graph_traits<CPartGraph>
+{
+};
+
+template <>
+struct property_map<CPartGraph, boost::vertex_point_t>
+{
+    typedef CPartPointMap<> type;
+    typedef CPartPointMap<> const_type;
+};
+
+template <>
+struct property_map<CPartGraph, boost::vertex_index_t>
+{
+    typedef CPartIndexMap<CPartGraph::vertex_descriptor> type;
+    typedef type                                         const_type;
+};
+
+template <>
+struct property_map<CPartGraph, boost::halfedge_index_t>
+{
+    typedef CPartIndexMap<CPartGraph::halfedge_descriptor> type;
+    typedef type                                           const_type;
+};
+
+template <>
+struct property_map<CPartGraph, boost::edge_index_t>
+{
+    typedef CPartIndexMap<CPartGraph::edge_descriptor> type;
+    typedef type                                       const_type;
+};
+
+template <>
+struct property_map<CPartGraph, boost::face_index_t>
+{
+    typedef CPartIndexMap<CPartGraph::face_descriptor> type;
+    typedef type                                       const_type;
+};
+
+} // namespace boost
+
+namespace CGAL {
+
+template <> struct graph_has_property<CPartGraph, boost::vertex_point_t>    : CGAL::Tag_true {};
+template <> struct graph_has_property<CPartGraph, boost::vertex_index_t>    : CGAL::Tag_true {};
+template <> struct graph_has_property<CPartGraph, boost::halfedge_index_t>  : CGAL::Tag_true {};
+template <> struct graph_has_property<CPartGraph, boost::edge_index_t>      : CGAL::Tag_true {};
+template <> struct graph_has_property<CPartGraph, boost::face_index_t>      : CGAL::Tag_true {};
+
+} // namespace CGAL
+
+//
+// HalfedgeGraph, HalfedgeListGraph and FaceListGraph functions of the part graph.
+//
+typedef boost::graph_traits<CPartGraph> CPartGraphTraits;
+
+inline CPartGraphTraits::vertex_descriptor target(CPartGraphTraits::halfedge_descriptor h, const CPartGraph& g)
+{
+    return CPartGraphTraits::vertex_descriptor(g.m_target[h.idx]);
+}
+
+inline CPartGraphTraits::vertex_descriptor source(CPartGraphTraits::halfedge_descriptor h, const CPartGraph& g)
+{
+    return CPartGraphTraits::vertex_descriptor(g.m_target[h.idx ^ 1]);
+}
+
+inline CPartGraphTraits::halfedge_descriptor next(CPartGraphTraits::halfedge_descriptor h, const CPartGraph& g)
+{
+    return CPartGraphTraits::halfedge_descriptor(g.m_next[h.idx]);
+}
+
+inline CPartGraphTraits::halfedge_descriptor prev(CPartGraphTraits::halfedge_descriptor h, const CPartGraph& g)
+{
+    return CPartGraphTraits::halfedge_descriptor(g.m_prev[h.idx]);
+}
+
+inline CPartGraphTraits::halfedge_descriptor opposite(CPartGraphTraits::halfedge_descriptor h, const CPartGraph&)
+{
+    return CPartGraphTraits::halfedge_descriptor(h.idx ^ 1);
+}
+
+inline CPartGraphTraits::face_descriptor face(CPartGraphTraits::halfedge_descriptor h, const CPartGraph& g)
+{
+    return (g.m_face[h.idx] == CPartGraph::null) ? CPartGraphTraits::null_face() : CPartGraphTraits::face_descriptor(g.m_face[h.idx]);
+}
+
+inline CPartGraphTraits::halfedge_descriptor halfedge(CPartGraphTraits::face_descriptor f, const CPartGraph& g)
+{
+    return CPartGraphTraits::halfedge_descriptor(g.m_face_he[f.idx]);
+}
+
+inline CPartGraphTraits::halfedge_descriptor halfedge(CPartGraphTraits::vertex_descriptor v, const CPartGraph& g)
+{
+    return (g.m_vertex_he[v.idx] == CPartGraph::null) ? CPartGraphTraits::null_halfedge() : CPartGraphTraits::halfedge_descriptor(g.m_vertex_he[v.idx]);
+}
+
+inline CPartGraphTraits::halfedge_descriptor halfedge(CPartGraphTraits::edge_descriptor e, const CPartGraph&)
+{
+    return CPartGraphTraits::halfedge_descriptor(e.idx * 2);
+}
+
+inline CPartGraphTraits::edge_descriptor edge(CPartGraphTraits::halfedge_descriptor h, const CPartGraph&)
+{
+    return CPartGraphTraits::edge_descriptor(h.idx / 2);
+}
+
+inline CPartGraphTraits::vertex_descriptor target(CPartGraphTraits::edge_descriptor e, const CPartGraph& g)
+{
+    return target(halfedge(e, g), g);
+}
+
+inline CPartGraphTraits::vertex_descriptor source(CPartGraphTraits::edge_descriptor e, const CPartGraph& g)
+{
+    return source(halfedge(e, g), g);
+}
+
+//
+// Halfedge from u to v, if any.
+//
+inline std::pair<CPartGraphTraits::halfedge_descriptor, bool> halfedge(CPartGraphTraits::vertex_descriptor u, CPartGraphTraits::vertex_descriptor v, const CPartGraph& g)
+{
+    auto h0 = g.m_vertex_he[v.idx];
+    if (h0 != CPartGraph::null)
+    {
+        auto h = h0;
+        do
+        {
+            if (g.m_target[h ^ 1] == u.idx)
+                return std::make_pair(CPartGraphTraits::halfedge_descriptor(h), true);
+            h = g.m_next[h] ^ 1;
+        } while (h != h0);
+    }
+    return std::make_pair(CPartGraphTraits::null_halfedge(), false);
+}
+
+inline std::pair<CPartGraphTraits::edge_descriptor, bool> edge(CPartGraphTraits::vertex_descriptor u, CPartGraphTraits::vertex_descriptor v, const CPartGraph& g)
+{
+    auto he = halfedge(u, v, g);
+    return std::make_pair(he.second ? edge(he.first, g) : CPartGraphTraits::edge_descriptor(), he.second);
+}
+
+inline CPartGraphTraits::degree_size_type degree(CPartGraphTraits::vertex_descriptor v, const CPartGraph& g)
+{
+    CPartGraphTraits::degree_size_type count = 0;
+    auto h0 = g.m_vertex_he[v.idx];
+    if (h0 == CPartGraph::null)
+        return 0;
+    auto h = h0;
+    do
+    {
+        count ++;
+        h = g.m_next[h] ^ 1;
+    } while (h != h0);
+    return count;
+}
+
+inline CPartGraphTraits::degree_size_type degree(CPartGraphTraits::face_descriptor, const CPartGraph&)
+{
+    return 3;
+}
+
+inline CPartGraphTraits::vertices_size_type num_vertices(const CPartGraph& g)   { return g.NumVertices(); }
+inline CPartGraphTraits::halfedges_size_type num_halfedges(const CPartGraph& g) { return g.NumHalfedges(); }
+inline CPartGraphTraits::edges_size_type num_edges(const CPartGraph& g)         { return g.NumEdges(); }
+inline CPartGraphTraits::faces_size_type num_faces(const CPartGraph& g)         { return g.NumFaces(); }
+
+inline CGAL::Iterator_range<CPartGraphTraits::vertex_iterator> vertices(const CPartGraph& g)
+{
+    return CGAL::make_range(CPartGraphTraits::vertex_iterator(CPartGraphTraits::vertex_descriptor(0)),
+                            CPartGraphTraits::vertex_iterator(CPartGraphTraits::vertex_descriptor(g.NumVertices())));
+}
+
+inline CGAL::Iterator_range<CPartGraphTraits::halfedge_iterator> halfedges(const CPartGraph& g)
+{
+    return CGAL::make_range(CPartGraphTraits::halfedge_iterator(CPartGraphTraits::halfedge_descriptor(0)),
+                            CPartGraphTraits::halfedge_iterator(CPartGraphTraits::halfedge_descriptor(g.NumHalfedges())));
+}
+
+inline CGAL::Iterator_range<CPartGraphTraits::edge_iterator> edges(const CPartGraph& g)
+{
+    return CGAL::make_range(CPartGraphTraits::edge_iterator(CPartGraphTraits::edge_descriptor(0)),
+                            CPartGraphTraits::edge_iterator(CPartGraphTraits::edge_descriptor(g.NumEdges())));
+}
+
+inline CGAL::Iterator_range<CPartGraphTraits::face_iterator> faces(const CPartGraph& g)
+{
+    return CGAL::make_range(CPartGraphTraits::face_iterator(CPartGraphTraits::face_descriptor(0)),
+                            CPartGraphTraits::face_iterator(CPartGraphTraits::face_descriptor(g.NumFaces())));
+}
+
+inline CPartPointMap<> get(boost::vertex_point_t, const CPartGraph& g)
+{
+    return CPartPointMap<>(&g);
+}
+
+inline CPartPoint get(boost::vertex_point_t, const CPartGraph& g, CPartGraphTraits::vertex_descriptor v)
+{
+    return g.Point(v.idx);
+}
+
+inline CPartIndexMap<CPartGraphTraits::vertex_descriptor> get(boost::vertex_index_t, const CPartGraph&)
+{
+    return CPartIndexMap<CPartGraphTraits::vertex_descriptor>();
+}
+
+inline CPartIndexMap<CPartGraphTraits::halfedge_descriptor> get(boost::halfedge_index_t, const CPartGraph&)
+{
+    return CPartIndexMap<CPartGraphTraits::halfedge_descriptor>();
+}
+
+inline CPartIndexMap<CPartGraphTraits::edge_descriptor> get(boost::edge_index_t, const CPartGraph&)
+{
+    return CPartIndexMap<CPartGraphTraits::edge_descriptor>();
+}
+
+inline CPartIndexMap<CPartGraphTraits::face_descriptor> get(boost::face_index_t, const CPartGraph&)
+{
+    return CPartIndexMap<CPartGraphTraits::face_descriptor>();
+}
@@ -0,0 +1,279 @@
+//
+// Local repair of a segmentation after small geometry edits.
+// The part is compared with the part of the last segmentation having the same triangles. The
+// proxies touching the moved triangles and the proxies next to them are fitted again and
+// flooded over their own triangles, and the other proxies are held fixed. The error is the L2,1
+// metric of the VSA: the area of a triangle times the squared distance of its normal to the
+// normal of the proxy.
+//
+#pragma once
+
+#include <lxsdk/lxu_math.hpp>
+#include <lxsdk/lxvmath.h>
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <unordered_map>
+
+#include "cmesh.hpp"
+
+class CPartRepair
+{
+public:
+    static constexpr unsigned npos = ~0u;
+
+    CPartRepair(CMesh& cmesh) : m_cmesh(cmesh) {}
+
+    unsigned NumMoved() const  { return m_moved; }
+    unsigned NumRegion() const { return static_cast<unsigned>(m_region.size()); }
+
+    //
+    // Set the proxies of the part from the source part and repair the proxies around the moved
+    // triangles. Return false when the parts do not match, or the region to repair is larger
+    // than the given ratio of the part, since a full run is better then.
+    //
+    bool Run(const CPart& part, const CPart& source, unsigned iterations, double max_ratio = 0.5)
+    {
+        auto ntri = part.tris.size();
+        if (ntri != source.tris.size() || part.vrts.size() != source.vrts.size() || part.topology != source.topology)
+            return false;
+        if (ntri == 0)
+            return true;
+
+        // moved vertices of the part. The part vertices are listed in CMesh vertex order, so the
+        // local index of a vertex is a binary search over their indices.
+        std::vector<unsigned> global(part.vrts.size());
+        std::vector<char>     moved(part.vrts.size(), 0);
+        for (auto i = 0u; i < part.vrts.size(); i++)
+        {
+            const CVerx& a = *part.vrts[i];
+            const CVerx& b = *source.vrts[i];
+            global[i] = a.index;
+            if (a.pos[0] != b.pos[0] || a.pos[1] != b.pos[1] || a.pos[2] != b.pos[2])
+                moved[i] = 1;
+        }
+        auto Moved = [&](const CVerxID& v) {
+            if (v->part != part.index)
+                return false;
+            auto it = std::lower_bound(global.begin(), global.end(), v->index);
+            return it != global.end() && *it == v->index && moved[it - global.begin()];
+        };
+
+        // take the proxies, and the proxies touching the moved triangles.
+        unsigned nproxy = 0;
+        std::vector<CTriangleID> moved_tris;
+        for (auto i = 0u; i < ntri; i++)
+        {
+            auto& tri = part.tris[i];
+            tri->proxy = source.tris[i]->proxy;
+            nproxy = std::max(nproxy, tri->proxy + 1);
+            if (Moved(tri->v0) || Moved(tri->v1) || Moved(tri->v2))
+                moved_tris.push_back(tri);
+        }
+        m_moved = static_cast<unsigned>(moved_tris.size());
+        if (moved_tris.empty())
+            return true;
+
+        std::vector<char> dirty(nproxy, 0);
+        for (auto& tri : moved_tris)
+            dirty[tri->proxy] = 1;
+
+        // the proxies next to the dirty proxies join the region.
+        m_active.assign(nproxy, 0);
+        for (auto& tri : part.tris)
+        {
+            if (!dirty[tri->proxy])
+                continue;
+            m_active[tri->proxy] = 1;
+            ForEachNeighbor(part, tri, [&](const CTriangleID& other) {
+                m_active[other->proxy] = 1;
+            });
+        }
+
+        m_region.clear();
+        m_local.clear();
+        for (auto& tri : part.tris)
+        {
+            if (m_active[tri->proxy])
+            {
+                m_local.emplace(tri.get(), static_cast<unsigned>(m_region.size()));
+                m_region.push_back(tri);
+            }
+        }
+        if (m_region.size() > max_ratio * ntri)
+            return false;
+
+        MakeRegion(part);
+
+        m_normal.assign(nproxy * 3, 0.0);
+        m_seed.assign(nproxy, npos);
+        for (auto i = 0u; i < std::max(iterations, 1u); i++)
+        {
+            Fit(nproxy);
+            Flood();
+        }
+        return true;
+    }
+
+private:
+    //
+    // Visit the triangles of the part sharing an edge with the triangle.
+    //
+    template <typename F>
+    void ForEachNeighbor(const CPart& part, const CTriangleID& tri, F func)
+    {
+        const CVerxID* vrts[3] = { &tri->v0, &tri->v1, &tri->v2 };
+        for (auto i = 0u; i < 3; i++)
+        {
+            CEdgeID edge = m_cmesh.FetchEdge(*vrts[i], *vrts[(i + 1) % 3]);
+            if (!edge)
+                continue;
+            for (auto& other : edge->tris)
+            {
+                if (other != tri && other->part == part.index)
+                    func(other);
+            }
+        }
+    }
+
+    //
+    // Normals, areas and neighbors of the region triangles.
+    //
+    void MakeRegion(const CPart& part)
+    {
+        auto nreg = m_region.size();
+        m_tri_normal.resize(nreg * 3);
+        m_area.resize(nreg);
+        m_neighbor.assign(nreg * 3, npos);
+        for (auto r = 0u; r < nreg; r++)
+        {
+            auto& tri = m_region[r];
+            LXtVector e0, e1, norm;
+            LXx_VSUB3(e0, tri->v1->pos, tri->v0->pos);
+            LXx_VSUB3(e1, tri->v2->pos, tri->v0->pos);
+            LXx_VCROSS(norm, e0, e1);
+            double len = LXx_VLEN(norm);
+            m_area[r] = len * 0.5;
+            if (len > 0.0)
+                LXx_VSCL(norm, 1.0 / len);
+            LXx_VCPY(&m_tri_normal[r * 3], norm);
+
+            auto k = 0u;
+            ForEachNeighbor(part, tri, [&](const CTriangleID& other) {
+                auto it = m_local.find(other.get());
+                if (it != m_local.end() && k < 3)
+                    m_neighbor[r * 3 + k ++] = it->second;
+            });
+        }
+    }
+
+    double Error(unsigned r, unsigned proxy) const
+    {
+        const double* n = &m_tri_normal[r * 3];
+        const double* p = &m_normal[proxy * 3];
+        LXtVector d;
+        LXx_VSUB3(d, n, p);
+        return m_area[r] * LXx_VDOT(d, d);
+    }
+
+    //
+    // Fit the normals of the region proxies to their triangles, and take the triangle of the
+    // smallest error of each proxy as its seed.
+    //
+    void Fit(unsigned nproxy)
+    {
+        std::fill(m_normal.begin(), m_normal.end(), 0.0);
+        for (auto r = 0u; r < m_region.size(); r++)
+        {
+            unsigned proxy = m_region[r]->proxy;
+            for (auto j = 0u; j < 3; j++)
+                m_normal[proxy * 3 + j] += m_area[r] * m_tri_normal[r * 3 + j];
+        }
+        for (auto p = 0u; p < nproxy; p++)
+        {
+            double* n = &m_normal[p * 3];
+            double len = LXx_VLEN(n);
+            if (len > 0.0)
+                LXx_VSCL(n, 1.0 / len);
+        }
+
+        std::vector<double> best(nproxy, 0.0);
+        std::fill(m_seed.begin(), m_seed.end(), npos);
+        for (auto r = 0u; r < m_region.size(); r++)
+        {
+            unsigned proxy = m_region[r]->proxy;
+            double   error = Error(r, proxy);
+            if (m_seed[proxy] == npos || error < best[proxy])
+            {
+                m_seed[proxy] = r;
+                best[proxy]   = error;
+            }
+        }
+    }
+
+    //
+    // Flood the region from the seeds. A triangle goes to the proxy of the smallest error among
+    // the flooded neighbors, and the triangles not reached keep their proxies.
+    //
+    void Flood()
+    {
+        struct CItem
+        {
+            double   error;
+            unsigned r;
+            unsigned proxy;
+            bool operator<(const CItem& other) const { return error > other.error; }
+        };
+
+        auto nreg = m_region.size();
+        std::vector<unsigned> label(nreg, npos);
+        std::priority_queue<CItem> queue;
+
+        auto Push = [&](unsigned r, unsigned proxy) {
+            for (auto k = 0u; k < 3; k++)
+            {
+                unsigned n = m_neighbor[r * 3 + k];
+                if (n != npos && label[n] == npos)
+                    queue.push({Error(n, proxy), n, proxy});
+            }
+        };
+
+        for (auto p = 0u; p < m_seed.size(); p++)
+        {
+            if (m_seed[p] != npos)
+                label[m_seed[p]] = p;
+        }
+        for (auto p = 0u; p < m_seed.size(); p++)
+        {
+            if (m_seed[p] != npos)
+                Push(m_seed[p], p);
+        }
+        while (!queue.empty())
+        {
+            CItem item = queue.top();
+            queue.pop();
+            if (label[item.r] != npos)
+                continue;
+            label[item.r] = item.proxy;
+            Push(item.r, item.proxy);
+        }
+
+        for (auto r = 0u; r < nreg; r++)
+        {
+            if (label[r] != npos)
+                m_region[r]->proxy = label[r];
+        }
+    }
+
+    CMesh&                                          m_cmesh;
+    unsigned                                        m_moved = 0;
+    std::vector<char>                               m_active;       // proxies to repair
+    std::vector<CTriangleID>                        m_region;       // triangles of the proxies to repair
+    std::unordered_map<const CTriangle*, unsigned>  m_local;        // region index of the triangles
+    std::vector<double>                             m_tri_normal;
+    std::vector<double>                             m_area;
+    std::vector<unsigned>                           m_neighbor;     // region indices of the neighbors, 3 per triangle
+    std::vector<double>                             m_normal;       // proxy normals
+    std::vector<unsigned>                           m_seed;         // region index of the proxy seeds
+};
@@ -0,0 +1,371 @@
+//
+// Mesh snapshot from Modo.
+// This copies the geometry of a Modo mesh into flat arrays in one pass over the points and the
+// polygons in index order. The later stages read the snapshot only, so they make no SDK calls
+// and can run on any thread.
+//
+#pragma once
+
+#include <lxsdk/lxidef.h>
+#include <lxsdk/lx_mesh.hpp>
+#include <lxsdk/lxu_math.hpp>
+#include <lxsdk/lxvmath.h>
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+#include "util.hpp"
+
+struct CMeshSnapshot
+{
+    static constexpr uint8_t fSelect = 0x01;   // LXsMARK_SELECT
+    static constexpr uint8_t fHide   = 0x02;   // LXsMARK_HIDE
+    static constexpr uint8_t fLock   = 0x04;   // LXsMARK_LOCK
+
+    unsigned NumPoints() const   { return static_cast<unsigned>(m_point_id.size()); }
+    unsigned NumPolygons() const { return static_cast<unsigned>(m_pol_id.size()); }
+
+    //
+    // Copy the points and polygons of the mesh. This is the only stage that talks to the SDK.
+    //
+    LxResult Build(CLxUser_Mesh& mesh)
+    {
+        CLxUser_MeshService mesh_svc;
+        LXtMarkMode pick = mesh_svc.SetMode(LXsMARK_SELECT);
+        LXtMarkMode hide = mesh_svc.SetMode(LXsMARK_HIDE);
+        LXtMarkMode lock = mesh_svc.SetMode(LXsMARK_LOCK);
+
+        Clear();
+
+        CLxUser_Point   point;
+        CLxUser_Polygon poly;
+        point.fromMesh(mesh);
+        poly.fromMesh(mesh);
+
+        unsigned npnt, npol;
+        mesh.PointCount(&npnt);
+        mesh.PolygonCount(&npol);
+        m_sdk_calls = 7;    // the modes, the accessors and the counts
+
+        std::unordered_map<LXtPointID, unsigned> point_index;
+        point_index.reserve(npnt);
+
+        m_point_id.resize(npnt);
+        m_pos.resize(npnt * 3);
+        for (auto i = 0u; i < npnt; i++)
+        {
+            point.SelectByIndex(i);
+            m_point_id[i] = point.ID();
+            point.Pos(&m_pos[i * 3]);
+            point_index.emplace(m_point_id[i], i);
+        }
+        m_sdk_calls += npnt * 3ul;
+
+        m_pol_id.resize(npol);
+        m_pol_type.resize(npol);
+        m_pol_flags.resize(npol);
+        m_pol_offset.resize(npol + 1);
+        m_pol_vrt.reserve(npol * 4);
+        for (auto i = 0u; i < npol; i++)
+        {
+            poly.SelectByIndex(i);
+            m_pol_id[i] = poly.ID();
+            poly.Type(&m_pol_type[i]);
+
+            uint8_t flags = 0;
+            if (poly.TestMarks(pick) == LXe_TRUE)
+                flags |= fSelect;
+            if (poly.TestMarks(hide) == LXe_TRUE)
+                flags |= fHide;
+            if (poly.TestMarks(lock) == LXe_TRUE)
+                flags |= fLock;
+            m_pol_flags[i] = flags;
+
+            m_pol_offset[i] = static_cast<unsigned>(m_pol_vrt.size());
+            unsigned nvert;
+            poly.VertexCount(&nvert);
+            for (auto j = 0u; j < nvert; j++)
+            {
+                LXtPointID vrt;
+                poly.VertexByIndex(j, &vrt);
+                m_pol_vrt.push_back(point_index[vrt]);
+            }
+            m_sdk_calls += 7 + nvert;
+        }
+        m_pol_offset[npol] = static_cast<unsigned>(m_pol_vrt.size());
+
+        BuildPointLinks();
+        return LXe_OK;
+    }
+
+    //
+    // Make point to polygon links. Polygons around a point are in polygon index order and a
+    // polygon is listed once even when it visits the point twice (keyholes).
+    //
+    void BuildPointLinks()
+    {
+        auto npnt = NumPoints();
+        auto npol = NumPolygons();
+
+        m_point_pol_offset.assign(npnt + 1, 0);
+        for (auto i = 0u; i < npol; i++)
+        {
+            for (auto k = m_pol_offset[i]; k < m_pol_offset[i + 1]; k++)
+            {
+                if (!VisitedBefore(i, k))
+                    m_point_pol_offset[m_pol_vrt[k] + 1] ++;
+            }
+        }
+        for (auto p = 0u; p < npnt; p++)
+            m_point_pol_offset[p + 1] += m_point_pol_offset[p];
+
+        m_point_pol.resize(m_point_pol_offset[npnt]);
+        std::vector<unsigned> fill(m_point_pol_offset.begin(), m_point_pol_offset.end() - 1);
+        for (auto i = 0u; i < npol; i++)
+        {
+            for (auto k = m_pol_offset[i]; k < m_pol_offset[i + 1]; k++)
+            {
+                if (!VisitedBefore(i, k))
+                    m_point_pol[fill[m_pol_vrt[k]] ++] = i;
+            }
+        }
+    }
+
+    // True if the point at the polygon corner k appeared at an earlier corner of the polygon.
+    bool VisitedBefore(unsigned pol, unsigned k) const
+    {
+        for (auto j = m_pol_offset[pol]; j < k; j++)
+        {
+            if (m_pol_vrt[j] == m_pol_vrt[k])
+                return true;
+        }
+        return false;
+    }
+
+    unsigned VertexCount(unsigned pol) const
+    {
+        return m_pol_offset[pol + 1] - m_pol_offset[pol];
+    }
+
+    const unsigned* Vertices(unsigned pol) const
+    {
+        return &m_pol_vrt[m_pol_offset[pol]];
+    }
+
+    const float* Pos(unsigned p) const
+    {
+        return &m_pos[p * 3];
+    }
+
+    bool Selected(unsigned pol) const { return (m_pol_flags[pol] & fSelect) != 0; }
+    bool Hidden(unsigned pol) const   { return (m_pol_flags[pol] & fHide) != 0; }
+    bool Locked(unsigned pol) const   { return (m_pol_flags[pol] & fLock) != 0; }
+
+    // selected, visible and unlocked surface polygons are triangulated into CMesh.
+    bool IsTarget(unsigned pol) const { return Selected(pol) && IsSurface(pol) && !Hidden(pol) && !Locked(pol); }
+
+    //
+    // Return true if the polygon is a surface polygon to be triangulated.
+    //
+    bool IsSurface(unsigned pol) const
+    {
+        if (VertexCount(pol) < 3)
+            return false;
+        LXtID4 type = m_pol_type[pol];
+        return (type == LXiPTYP_FACE) || (type == LXiPTYP_PSUB) || (type == LXiPTYP_SUBD);
+    }
+
+    //
+    // Polygon normal by Newell's method.
+    //
+    void Normal(unsigned pol, LXtVector norm) const
+    {
+        auto nvert = VertexCount(pol);
+        auto vrts  = Vertices(pol);
+        LXx_VCLR(norm);
+        for (auto i = 0u; i < nvert; i++)
+        {
+            const float* a = Pos(vrts[i]);
+            const float* b = Pos(vrts[(i + 1) % nvert]);
+            norm[0] += (static_cast<double>(a[1]) - b[1]) * (static_cast<double>(a[2]) + b[2]);
+            norm[1] += (static_cast<double>(a[2]) - b[2]) * (static_cast<double>(a[0]) + b[0]);
+            norm[2] += (static_cast<double>(a[0]) - b[0]) * (static_cast<double>(a[1]) + b[1]);
+        }
+        if (!lx::VectorNormalize(norm))
+            LXx_VSET3(norm, 0.0, 1.0, 0.0);
+    }
+
+    //
+    // Number of triangles of the target polygons.
+    //
+    unsigned TriangleCount() const
+    {
+        unsigned count = 0;
+        for (auto i = 0u; i < NumPolygons(); i++)
+        {
+            if (IsTarget(i))
+                count += VertexCount(i) - 2;
+        }
+        return count;
+    }
+
+    //
+    // Visit the polygons having the edge between points a and b.
+    //
+    template <typename F>
+    void ForEachEdgePolygon(unsigned a, unsigned b, F func) const
+    {
+        for (auto k = m_point_pol_offset[a]; k < m_point_pol_offset[a + 1]; k++)
+        {
+            auto pol   = m_point_pol[k];
+            auto nvert = VertexCount(pol);
+            auto vrts  = Vertices(pol);
+            for (auto i = 0u; i < nvert; i++)
+            {
+                auto j = (i + 1) % nvert;
+                if ((vrts[i] == a && vrts[j] == b) || (vrts[i] == b && vrts[j] == a))
+                {
+                    func(pol);
+                    break;
+                }
+            }
+        }
+    }
+
+    //
+    // Group the polygons around the point into fans. Two polygons belong to the same fan when
+    // they share an edge at the point and both are visible and unlocked. This is the rule used to
+    // split a source point into several vertices at hidden or locked polygons. group[i] is the
+    // smallest link index of the fan of the i-th polygon around the point.
+    //
+    unsigned PointFans(unsigned p, std::vector<unsigned>& group) const
+    {
+        auto begin = m_point_pol_offset[p];
+        auto npol  = m_point_pol_offset[p + 1] - begin;
+
+        group.resize(npol);
+
+        // neighbor points of the fan edges (prev, next) in each polygon
+        std::vector<std::pair<unsigned,unsigned>> sides(npol, std::make_pair(~0u, ~0u));
+
+        for (auto i = 0u; i < npol; i++)
+        {
+            auto pol = m_point_pol[begin + i];
+            group[i] = i;
+            if (m_pol_flags[pol] & (fHide | fLock))
+                continue;
+            auto nvert = VertexCount(pol);
+            auto vrts  = Vertices(pol);
+            for (auto j = 0u; j < nvert; j++)
+            {
+                if (vrts[j] == p)
+                {
+                    sides[i].first  = vrts[(j + nvert - 1) % nvert];
+                    sides[i].second = vrts[(j + 1) % nvert];
+                    break;
+                }
+            }
+        }
+
+        auto find = [&](unsigned i) {
+            while (group[i] != i)
+                i = group[i] = group[group[i]];
+            return i;
+        };
+
+        for (auto i = 0u; i < npol; i++)
+        {
+            if (sides[i].first == ~0u)
+                continue;
+            for (auto j = i + 1; j < npol; j++)
+            {
+                if (sides[j].first == ~0u)
+                    continue;
+                if (sides[i].first  == sides[j].first || sides[i].first  == sides[j].second ||
+                    sides[i].second == sides[j].first || sides[i].second == sides[j].second)
+                {
+                    unsigned a = find(i), b = find(j);
+                    if (a != b)
+                        group[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+        for (auto i = 0u; i < npol; i++)
+            group[i] = find(i);
+
+        return npol;
+    }
+
+    template <typename T>
+    static size_t Bytes(const std::vector<T>& v)
+    {
+        return v.capacity() * sizeof(T);
+    }
+
+    size_t MemoryUsage() const
+    {
+        return Bytes(m_point_id) + Bytes(m_pos) + Bytes(m_pol_id) + Bytes(m_pol_type) + Bytes(m_pol_flags) +
+               Bytes(m_pol_offset) + Bytes(m_pol_vrt) + Bytes(m_point_pol_offset) + Bytes(m_point_pol);
+    }
+
+    //
+    // Hash of the positions, the polygons and their flags. The element IDs are not hashed, since
+    // each evaluation of a procedural mesh has new ones. The parts built from an earlier snapshot
+    // with the same hash are valid for this one once they take its element IDs.
+    //
+    uint64_t Hash() const
+    {
+        uint64_t hash = 0;
+        auto mix = [&hash](uint64_t key) { hash = MeshUtil::Mix64(hash ^ key); };
+
+        mix(NumPoints());
+        mix(NumPolygons());
+        for (auto i = 0u; i < NumPoints(); i++)
+        {
+            uint32_t bits[3];
+            std::memcpy(bits, Pos(i), sizeof(bits));
+            mix(static_cast<uint64_t>(bits[0]) << 32 | bits[1]);
+            mix(bits[2]);
+        }
+        for (auto i = 0u; i < NumPolygons(); i++)
+        {
+            mix(static_cast<uint64_t>(m_pol_type[i]) << 8 | m_pol_flags[i]);
+            mix(m_pol_offset[i + 1]);
+        }
+        for (auto vrt : m_pol_vrt)
+            mix(vrt);
+        return hash;
+    }
+
+    void Clear()
+    {
+        m_point_id.clear();
+        m_pos.clear();
+        m_pol_id.clear();
+        m_pol_type.clear();
+        m_pol_flags.clear();
+        m_pol_offset.clear();
+        m_pol_vrt.clear();
+        m_point_pol_offset.clear();
+        m_point_pol.clear();
+        m_sdk_calls = 0;
+    }
+
+    // points in point index order
+    std::vector<LXtPointID>   m_point_id;
+    std::vector<float>        m_pos;           // positions (xyz)
+
+    // polygons in polygon index order
+    std::vector<LXtPolygonID> m_pol_id;
+    std::vector<LXtID4>       m_pol_type;
+    std::vector<uint8_t>      m_pol_flags;     // fSelect, fHide, fLock
+    std::vector<unsigned>     m_pol_offset;    // polygon vertex list offsets
+    std::vector<unsigned>     m_pol_vrt;       // point indices of polygon vertex lists
+
+    // polygons around each point
+    std::vector<unsigned>     m_point_pol_offset, m_point_pol;
+
+    unsigned long             m_sdk_calls = 0;    // SDK calls of the last Build
+};
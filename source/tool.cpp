@@ -21,6 +21,12 @@ CTool::CTool()
         { CApproximate::EDGE_SSET, "sset" },
         { 0, "=approximate_segment" }, 0
     };
+    static const LXtTextValueHint approximate_kernel[] = {
+        { CApproximate::EPICK, "epick" },
+        { CApproximate::CARTESIAN, "cartesian" },
+        { CApproximate::CARTESIAN_FLOAT, "cartesianFloat" },
+        { 0, "=approximate_kernel" }, 0
+    };
 
     CLxUser_PacketService sPkt;
     CLxUser_MeshService   sMesh;
@@ -41,6 +47,17 @@ CTool::CTool()
 
     dyna_Add(ATTRs_SETCOLOR, LXsTYPE_BOOLEAN);
 
+    dyna_Add(ATTRs_KERNEL, LXsTYPE_INTEGER);
+    dyna_SetHint(ATTRa_KERNEL, approximate_kernel);
+
+    dyna_Add(ATTRs_DEBUG, LXsTYPE_BOOLEAN);
+
+    dyna_Add(ATTRs_THREADS, LXsTYPE_INTEGER);
+
+    dyna_Add(ATTRs_SEED, LXsTYPE_INTEGER);
+
+    dyna_Add(ATTRs_CACHE, LXsTYPE_INTEGER);
+
     tool_Reset();
 
     sPkt.NewVectorType(LXsCATEGORY_TOOL, v_type);
@@ -62,6 +79,7 @@ CTool::CTool()
     mode_select = sMesh.SetMode("select");
 
     m_proxies0 = 0;
+    m_session.reset(new CApproximateSession);
 }
 
 /*
@@ -77,6 +95,11 @@ void CTool::tool_Reset()
     dyna_Value(ATTRa_SEGMENT).SetInt(vsa.m_segment);
     dyna_Value(ATTRa_SETCOLOR).SetInt(vsa.m_set_color);
     dyna_Value(ATTRa_SSET).SetString(vsa.m_sset.c_str());
+    dyna_Value(ATTRa_KERNEL).SetInt(vsa.m_kernel);
+    dyna_Value(ATTRa_DEBUG).SetInt(vsa.m_debug);
+    dyna_Value(ATTRa_THREADS).SetInt(vsa.m_threads);
+    dyna_Value(ATTRa_SEED).SetInt(vsa.m_seed);
+    dyna_Value(ATTRa_CACHE).SetInt(CResultCache::default_megabytes);
 }
 
 /*
@@ -114,6 +137,11 @@ LxResult CTool::tool_GetOp(void** ppvObj, unsigned flags)
     dyna_Value(ATTRa_SEGMENT).GetInt(&toolop->m_segment);
     dyna_Value(ATTRa_SETCOLOR).GetInt(&toolop->m_set_color);
     dyna_Value(ATTRa_SSET).GetString(toolop->m_sset);
+    dyna_Value(ATTRa_KERNEL).GetInt(&toolop->m_kernel);
+    dyna_Value(ATTRa_DEBUG).GetInt(&toolop->m_debug);
+    dyna_Value(ATTRa_THREADS).GetInt(&toolop->m_threads);
+    dyna_Value(ATTRa_SEED).GetInt(&toolop->m_seed);
+    dyna_Value(ATTRa_CACHE).GetInt(&toolop->m_cache_size);
 
     toolop->offset_view = offset_view;
     toolop->offset_screen = offset_screen;
@@ -126,6 +154,11 @@ LxResult CTool::tool_GetOp(void** ppvObj, unsigned flags)
     {
         toolop->m_new_mesh = 0;
     }
+    else
+    {
+        // the interactive evaluations refine the live parts of the last evaluation.
+        toolop->m_session = m_session;
+    }
 
 	return LXe_OK;
 }
@@ -213,14 +246,27 @@ void CTool::tmod_Up(ILxUnknownID vts, ILxUnknownID adjust)
     m_proxies0 = 0;
 }
 
+/*
+ * The live contexts of the layers are freed when the tool is dropped.
+ */
+void CTool::tmod_Drop()
+{
+    m_session->Clear();
+}
+
 void CTool::atrui_UIHints2(unsigned int index, CLxUser_UIHints& hints)
 {
     switch (index)
     {   
         case ATTRa_PROXIES:
         case ATTRa_ITERATION:
+        case ATTRa_THREADS:
+        case ATTRa_CACHE:
             hints.MinInt(0);
             break;
+        case ATTRa_SEED:
+            hints.MinInt(-1);
+            break;
     }
 }
 
@@ -404,8 +450,7 @@ LxResult CToolOp::top_Evaluate(ILxUnknownID vts)
      * Start the scan in edit mode.
      */
     CLxUser_LayerScan  scan;
-    CLxUser_Mesh       base_mesh, edit_mesh;
-    CApproximate       vsa;
+    CLxUser_Mesh       base_mesh;
 
     if ((m_iteration == 0) || (m_proxies == 0))
         return LXe_OK;
@@ -421,44 +466,78 @@ LxResult CToolOp::top_Evaluate(ILxUnknownID vts)
 
     subject.BeginScan(LXf_LAYERSCAN_EDIT_POLYS, scan);
 
-    vsa.m_iteration = m_iteration;
-    vsa.m_proxies = m_proxies;
-    vsa.m_mode = m_mode;
-    vsa.m_segment = m_segment;
-    vsa.m_set_color = m_set_color;
-    vsa.m_sset = m_sset;
-    vsa.m_new_mesh = m_new_mesh;
+    // The live contexts of the session are used by one evaluation at a time.
+    std::unique_lock<std::mutex> session_lock;
+    if (m_session)
+        session_lock = std::unique_lock<std::mutex>(m_session->mutex);
+
+    // The mesh operator writes back the cached results of the same snapshots and settings, and
+    // both the tool and the operator reuse the outputs of the unchanged parts. A negative seed
+    // asks for a new result at every run.
+    CResultCache& cache = CResultCache::Shared();
+    CResultCache& part_cache = CResultCache::Parts();
+    bool caching = (m_seed >= 0) && (m_cache_size > 0);
+    CResultCache::SetCapacities(static_cast<unsigned>(std::max(m_cache_size, 0)));
 
+    // Take the snapshots of the layers first, the SDK is called on this thread only.
     auto n = scan.NumLayers();
+    std::vector<std::unique_ptr<CLayerContext>> layers(n);
+    if (m_session)
+        m_session->layers.resize(n);
     for (auto i = 0u; i < n; i++)
     {
-        scan.BaseMeshByIndex(i, base_mesh);
-        scan.EditMeshByIndex(i, edit_mesh);
+        layers[i].reset(new CLayerContext);
+        CApproximate& vsa = *layers[i]->vsa;
+
+        vsa.m_iteration = m_iteration;
+        vsa.m_proxies = m_proxies;
+        vsa.m_mode = m_mode;
+        vsa.m_segment = m_segment;
+        vsa.m_set_color = m_set_color;
+        vsa.m_sset = m_sset;
+        vsa.m_new_mesh = m_new_mesh;
+        vsa.m_kernel = m_kernel;
+        vsa.m_debug = m_debug;
+        vsa.m_threads = m_threads;
+        vsa.m_seed = m_seed;
+        vsa.m_part_cache = caching ? &part_cache : nullptr;
 
-        vsa.ApproximateMesh(base_mesh);
+        scan.BaseMeshByIndex(i, base_mesh);
+        scan.EditMeshByIndex(i, layers[i]->edit_mesh);
+        layers[i]->Snapshot(base_mesh, m_session ? &m_session->layers[i] : nullptr);
+        if (caching && !m_session)
+            layers[i]->LookUp(cache);
+    }
+    if (caching && !m_session && m_debug)
+        cache.Print();
 
-        if (vsa.m_mode == CApproximate::APPROXIMATION)
-        {
-            if (vsa.m_new_mesh)
-            {
-                CLxUser_Mesh new_mesh;
-                MeshUtil::NewMesh(new_mesh);
-                vsa.WriteApproximation(new_mesh);
-            }
-            else
-            {
-                vsa.WriteApproximation(edit_mesh);
-                vsa.m_cmesh.Remove(edit_mesh);
-            }
-        }
-        else if (vsa.m_mode == CApproximate::SEGMENTATION)
+    // A single layer writes each part back as soon as it is approximated. Several layers are
+    // computed concurrently, and written back in layer order after that.
+    bool concurrent = (n > 1) && (m_threads != 1);
+    if (concurrent)
+    {
+        CTaskGroup group(CThreadPool::Shared(static_cast<unsigned>(std::max(m_threads, 0))));
+        for (auto i = 0u; i < n; i++)
         {
-            vsa.WriteSegmentations(edit_mesh);
+            CLayerContext* layer = layers[i].get();
+            group.Run([layer]() { layer->Compute(false); });
         }
+        group.Wait();
+    }
 
-
+    for (auto i = 0u; i < n; i++)
+    {
+        if (!concurrent)
+            layers[i]->Compute(true);
+        layers[i]->Write();
         scan.SetMeshChange(i, LXf_MESHEDIT_GEOMETRY);
+
+        // release the outputs of the layer as soon as it is written. The live context of the
+        // layer stays in the session of the tool.
+        layers[i].reset();
     }
+    if (caching && m_debug)
+        part_cache.Print();
 
     scan.Apply();
 
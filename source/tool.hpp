@@ -27,7 +27,11 @@
 #include <lxsdk/lx_select.hpp>
 #include <lxsdk/lx_seltypes.hpp>
 
+#include <memory>
+#include <mutex>
+
 #include "approximate.hpp"
+#include "cache.hpp"
 
 using namespace lx_err;
 
@@ -41,6 +45,11 @@ const char* SRVNAME_TOOLOP = "toolop.approximate";
 #define ATTRs_SEGMENT   "segment"
 #define ATTRs_SSET      "sset"
 #define ATTRs_SETCOLOR  "setColor"
+#define ATTRs_KERNEL    "kernel"
+#define ATTRs_DEBUG     "debug"
+#define ATTRs_THREADS   "threads"
+#define ATTRs_SEED      "seed"
+#define ATTRs_CACHE     "cacheSize"
 
 #define ATTRa_MODE      0
 #define ATTRa_PROXIES   1
@@ -49,11 +58,159 @@ const char* SRVNAME_TOOLOP = "toolop.approximate";
 #define ATTRa_SEGMENT   4
 #define ATTRa_SSET      5
 #define ATTRa_SETCOLOR  6
+#define ATTRa_KERNEL    7
+#define ATTRa_DEBUG     8
+#define ATTRa_THREADS   9
+#define ATTRa_SEED      10
+#define ATTRa_CACHE     11
 
 #ifndef LXx_OVERRIDE
 #define LXx_OVERRIDE override
 #endif
 
+//
+// Live contexts of the layers kept by the tool between the evaluations of its tool operations,
+// so hauling the number of proxies refines the last partition. A layer keeps the context of its
+// last evaluation, with its mesh, snapshot and live parts, until the next snapshot does not match
+// or the tool is dropped.
+//
+struct CApproximateSession
+{
+    std::mutex                                 mutex;
+    std::vector<std::shared_ptr<CApproximate>> layers;
+
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        layers.clear();
+    }
+};
+
+//
+// Context of a layer. The snapshot and the write-back call the SDK on the main thread, and the
+// compute between them runs on any thread. When the soups are not written while computing, they
+// are buffered until the write-back.
+//
+struct CLayerContext
+{
+    std::shared_ptr<CApproximate> vsa;
+    CLxUser_Mesh                  edit_mesh;
+    CLxUser_Mesh                  new_mesh;
+    std::unique_ptr<CSoupWriter>  writer;
+    std::vector<CPartOutput>      outputs;
+    bool                          streamed = false;
+
+    // result cache of the mesh operator
+    bool                          caching = false;
+    uint64_t                      key = 0;
+    CResultCache::ResultPtr       cached;
+    CResultCache::Result          record;
+
+    CLayerContext() : vsa(new CApproximate) {}
+
+    //
+    // Look up the result of the snapshot. When it is not cached, the result of this evaluation
+    // is recorded for the cache.
+    //
+    void LookUp(CResultCache& cache)
+    {
+        caching = true;
+        key     = vsa->ResultKey();
+        cached  = cache.Find(key);
+    }
+
+    //
+    // Take the snapshot of the layer. When the live context of the session has the parts of the
+    // same mesh, it is refined with the settings of this evaluation. Otherwise this context
+    // becomes the live context, and repairs the segmentation of the live context when the mesh
+    // is an edit of the same triangles.
+    //
+    LxResult Snapshot(CLxUser_Mesh& base_mesh, std::shared_ptr<CApproximate>* live = nullptr)
+    {
+        LxResult result = vsa->Snapshot(base_mesh);
+        if (result != LXe_OK)
+            return result;
+        if (live)
+        {
+            if (*live && (*live)->CanRefine(*vsa))
+            {
+                (*live)->CopySettings(*vsa);
+                vsa = *live;
+            }
+            else
+            {
+                if (*live && (*live)->CanRepair(*vsa))
+                    vsa->m_repair_source = *live;
+                vsa->m_keep_live = true;
+                *live = vsa;
+            }
+        }
+        if (vsa->m_mode == CApproximate::APPROXIMATION)
+        {
+            if (vsa->m_new_mesh)
+                MeshUtil::NewMesh(new_mesh);
+            writer.reset(new CSoupWriter(vsa->m_new_mesh ? new_mesh : edit_mesh));
+        }
+        return LXe_OK;
+    }
+
+    //
+    // When streamed, this runs on the main thread and the parts are written back while the
+    // later parts are computed.
+    //
+    LxResult Compute(bool stream)
+    {
+        streamed = stream;
+        if (stream && vsa->m_mode == CApproximate::SEGMENTATION)
+            vsa->BeginSegmentations(edit_mesh);
+
+        LxResult result = vsa->Compute([this, stream](CPartID part, CPartOutput& output) {
+            if (vsa->m_mode == CApproximate::SEGMENTATION)
+            {
+                if (stream)
+                    vsa->WriteSegmentation(part);
+                return;
+            }
+            if (output.result != LXe_OK)
+                return;
+            if (stream)
+            {
+                if (writer->Write(output.points, output.triangles) != LXe_OK)
+                    std::cerr << "warning: failed to write the triangles of part " << part->index << "\n";
+                return;
+            }
+            outputs.emplace_back();
+            outputs.back().points.swap(output.points);
+            outputs.back().triangles.swap(output.triangles);
+        }, cached.get(), (caching && !cached) ? &record : nullptr);
+
+        if (caching && !cached && !record.empty())
+            CResultCache::Shared().Insert(key, std::move(record));
+        return result;
+    }
+
+    LxResult Write()
+    {
+        if (vsa->m_mode == CApproximate::APPROXIMATION)
+        {
+            for (auto& output : outputs)
+            {
+                if (writer->Write(output.points, output.triangles) != LXe_OK)
+                    std::cerr << "warning: failed to write the approximated triangles\n";
+                output = CPartOutput();
+            }
+            if (vsa->m_debug)
+                std::cout << "wrote " << writer->m_points << " points " << writer->m_polygons << " polygons" << std::endl;
+            if (!vsa->m_new_mesh)
+                vsa->m_cmesh.Remove(edit_mesh);
+            return LXe_OK;
+        }
+        if (streamed)
+            return LXe_OK;
+        return vsa->WriteSegmentations(edit_mesh);
+    }
+};
+
 //
 // The Tool Operation is evaluated by the procedural modeling system.
 //
@@ -80,7 +237,14 @@ class CToolOp : public CLxImpl_ToolOperation
         int    m_segment;
         int    m_new_mesh;
         int    m_set_color;
+        int    m_kernel;    // geometry kernel of the VSA path
+        int    m_debug;     // full validation and verbose output
+        int    m_threads;   // number of threads for the parts, 0 for all cores
+        int    m_seed;      // seed of the proxies, negative for a new seed at every run
+        int    m_cache_size;// megabytes of the result cache of the mesh operator, 0 to disable
         std::string m_sset;
+
+        std::shared_ptr<CApproximateSession> m_session;
 };
 
 /*
@@ -105,6 +269,7 @@ public:
     LxResult    tmod_Down(ILxUnknownID vts, ILxUnknownID adjust) LXx_OVERRIDE;
     void        tmod_Move(ILxUnknownID vts, ILxUnknownID adjust) LXx_OVERRIDE;
     void        tmod_Up(ILxUnknownID vts, ILxUnknownID adjust) LXx_OVERRIDE;
+    void        tmod_Drop() LXx_OVERRIDE;
 
     using CLxDynamicAttributes::atrui_UIHints;  // to distinguish from the overloaded version in CLxImpl_AttributesUI
 
@@ -135,5 +300,7 @@ public:
 
     static LXtTagInfoDesc descInfo[];
     int    m_proxies0;
+
+    std::shared_ptr<CApproximateSession> m_session;
 };
 
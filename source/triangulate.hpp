@@ -13,6 +13,7 @@
 
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Constrained_Delaunay_triangulation_2.h>
+#include <CGAL/Triangulation_vertex_base_with_info_2.h>
 #include <CGAL/Delaunay_mesher_2.h>
 #include <CGAL/Delaunay_mesh_face_base_2.h>
 #include <CGAL/Delaunay_mesh_vertex_base_2.h>
@@ -20,13 +21,18 @@
 
 #include <CGAL/mark_domain_in_triangulation.h>
 
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include <vector>
+#include <algorithm>
 
 #include "util.hpp"
+#include "snapshot.hpp"
 
 typedef CGAL::Exact_predicates_inexact_constructions_kernel K;
-typedef CGAL::Triangulation_vertex_base_2<K> Vb;
-typedef CGAL::Delaunay_mesh_face_base_2<K> Fb;
+typedef CGAL::Triangulation_vertex_base_with_info_2<unsigned, K> Vb;   // source point index
+typedef CGAL::Delaunay_mesh_face_base_2<K> Fb;                          // has the in domain flag
 typedef CGAL::Triangulation_data_structure_2<Vb, Fb> Tds;
 typedef CGAL::Constrained_Delaunay_triangulation_2<K, Tds> CDT;
 typedef CGAL::Delaunay_mesh_size_criteria_2<CDT> Criteria;
@@ -36,95 +42,302 @@ typedef CDT::Vertex_handle Vertex_handle;
 typedef CDT::Face_handle Face_handle;
 typedef CDT::Point CPoint;
 
+typedef std::array<unsigned,3> CTriple;     // point indices of a triangle
+
+//
+// Number of polygons triangulated by each path of CTriangulate::Polygon().
+//
+struct CTriangulateStats
+{
+    unsigned triangle = 0;  // triangles taken as is
+    unsigned quad     = 0;  // quads split from the most convex corner
+    unsigned convex   = 0;  // planar convex polygons split into a fan
+    unsigned cdt      = 0;  // concave, non-planar or keyhole polygons by constrained Delaunay
+    unsigned earclip  = 0;  // polygons the constrained Delaunay failed on by ear clipping
+    unsigned fallback = 0;  // polygons both failed on
+
+    void Add(const CTriangulateStats& stats)
+    {
+        triangle += stats.triangle;
+        quad     += stats.quad;
+        convex   += stats.convex;
+        cdt      += stats.cdt;
+        earclip  += stats.earclip;
+        fallback += stats.fallback;
+    }
+
+    void Print() const
+    {
+        printf("Triangulate %u triangles %u quads %u convex %u cdt %u earclip %u fallback\n", triangle, quad, convex, cdt, earclip, fallback);
+    }
+};
+
+//
+// Triangulate polygons of the mesh snapshot. Polygon vertices and triangles are given as point
+// indices of the snapshot, so no SDK calls are made here.
+//
 class CTriangulate
 {
 public:
-    CTriangulate (CLxUser_Mesh& mesh) { m_mesh = mesh; }
-    LxResult ConstraintDelaunay(AxisPlane& axisPlane, std::vector<LXtPointID>& source, std::vector<std::vector<LXtPointID>>& tris)
+    // Relative distance from the polygon plane to accept a polygon as planar.
+    static constexpr double planar_tolerance = 1e-4;
+
+    CTriangulate (const CMeshSnapshot& snap) : m_snap(snap) {}
+
+    //
+    // Triangulate the polygon of the snapshot. Triangles and quads use fixed size kernels, planar
+    // convex polygons are split into a fan, and only the other polygons go through constrained
+    // Delaunay triangulation with ear clipping and then the fan as fallback.
+    //
+    LxResult Polygon(unsigned pol, std::vector<CTriple>& tris)
     {
-        CLxUser_Point point, point1;
-        point.fromMesh(m_mesh);
-        point1.fromMesh(m_mesh);
+        tris.clear();
 
-        CDT cdt;
+        auto nvert = m_snap.VertexCount(pol);
+        if (nvert < 3)
+            return LXe_FAILED;
 
-        std::vector<Vertex_handle> vertex_handles;
+        auto vrts = m_snap.Vertices(pol);
+        if (nvert == 3)
+        {
+            Fan<3>(vrts, 0, tris);
+            m_stats.triangle ++;
+            return LXe_OK;
+        }
 
-        std::unordered_map<LXtPointID,unsigned> indices;
+        LXtVector norm;
+        m_snap.Normal(pol, norm);
 
-        CLxUser_MeshService s_mesh;
+        if (nvert == 4)
+        {
+            Fan<4>(vrts, FixedStart(vrts, nvert, norm), tris);
+            m_stats.quad ++;
+            return LXe_OK;
+        }
 
-        LXtMarkMode mark_dupl;
-        mark_dupl = s_mesh.ClearMode(LXsMARK_USER_0);
+        unsigned start;
+        if (ConvexStart(vrts, nvert, norm, start))
+        {
+            for (auto i = 1u; i < nvert - 1; i++)
+                tris.push_back({vrts[start], vrts[(start + i) % nvert], vrts[(start + i + 1) % nvert]});
+            m_stats.convex ++;
+            return LXe_OK;
+        }
 
-        auto nvert = source.size();
-        for (auto i = 0u; i < nvert; i++)
+        FixedVertexList(pol, norm, m_points);
+
+        AxisPlane axisPlane(norm);
+        if (ConstraintDelaunay(axisPlane, m_points, tris) == LXe_OK)
         {
-            point.Select(source[i]);
-            point.SetMarks(mark_dupl);
+            m_stats.cdt ++;
+            return LXe_OK;
+        }
+        tris.clear();
+        if (EarClipping(axisPlane, m_points, tris) == LXe_OK)
+        {
+            m_stats.earclip ++;
+            return LXe_OK;
         }
+        tris.clear();
+        for (auto i = 1u; i < m_points.size() - 1; i++)
+            tris.push_back({m_points[0], m_points[i], m_points[i + 1]});
+        m_stats.fallback ++;
+        return LXe_OK;
+    }
+
+    //
+    // Fan of a polygon with N vertices from the start corner.
+    //
+    template <unsigned N>
+    static void Fan(const unsigned* vrts, unsigned start, std::vector<CTriple>& tris)
+    {
+        for (auto i = 1u; i < N - 1; i++)
+            tris.push_back({vrts[start], vrts[(start + i) % N], vrts[(start + i + 1) % N]});
+    }
+
+    //
+    // Get the vertex list of the polygon. If the first vertex is not convex, the list is rotated
+    // to start at the most convex corner. This is MeshUtil::PolygonFixedVertexList() on the snapshot.
+    //
+    bool FixedVertexList(unsigned pol, const LXtVector norm, std::vector<unsigned>& points)
+    {
+        auto nvert = m_snap.VertexCount(pol);
+        auto vrts  = m_snap.Vertices(pol);
+        points.assign(vrts, vrts + nvert);
+
+        auto index = FixedStart(vrts, nvert, norm);
+        if (index == 0)
+            return false;
+
+        std::rotate(points.begin(), points.begin() + index, points.end());
+        return true;
+    }
+
+    //
+    // Corner to start the fixed vertex list of FixedVertexList().
+    //
+    unsigned FixedStart(const unsigned* vrts, unsigned nvert, const LXtVector norm) const
+    {
+        if (nvert < 4)
+            return 0;
+
+        AxisPlane axisPlane(MathUtil::MaxExtent(norm));
 
-        mark_dupl = s_mesh.SetMode(LXsMARK_USER_0);
+        auto orient = Orientation(axisPlane, vrts, nvert);
+
+        int i = norm[axisPlane.m_axis] < 0.0;
+        if ((i ^ orient))
+            return 0;
+
+        double dmax = 0.0;
+        unsigned index = 0;
 
-        unsigned n = 0;
         for (auto i = 0u; i < nvert; i++)
         {
-            LXtPointID vrt = source[i];
-            if (indices.find(vrt) == indices.end())
+            const float* prev = m_snap.Pos(vrts[(i - 1 + nvert) % nvert]);
+            const float* curr = m_snap.Pos(vrts[i]);
+            const float* next = m_snap.Pos(vrts[(i + 1) % nvert]);
+            double d = axisPlane.Determ(prev, curr, next);
+            if (((d >= 0.0) == orient) && (std::abs(d) >= dmax))
             {
-                indices.insert(std::make_pair(vrt, n ++));
+                dmax = std::abs(d);
+                index = i;
             }
-            else
+        }
+        return index;
+    }
+
+    //
+    // Return true if the polygon is planar and strictly convex without repeated points, and get
+    // the most convex corner to start a fan. The corners are tested on the axis plane of the
+    // normal, where a convex polygon turns the same way at every corner and winds once.
+    //
+    bool ConvexStart(const unsigned* vrts, unsigned nvert, const LXtVector norm, unsigned& start)
+    {
+        auto axis = MathUtil::MaxExtent(norm);
+        auto ix   = (axis + 1) % 3;
+        auto iy   = (axis + 2) % 3;
+        bool ccw  = norm[axis] > 0.0;
+
+        // planarity by the distance of the points from the plane through the first point.
+        const float* p0 = m_snap.Pos(vrts[0]);
+        double lo[3] = {p0[0], p0[1], p0[2]};
+        double hi[3] = {p0[0], p0[1], p0[2]};
+        double dmin = 0.0, dmax = 0.0;
+        for (auto i = 1u; i < nvert; i++)
+        {
+            const float* p = m_snap.Pos(vrts[i]);
+            double d = 0.0;
+            for (auto k = 0u; k < 3; k++)
             {
-                point.Select(vrt);
-                point.SetMarks(mark_dupl);
+                lo[k] = std::min(lo[k], static_cast<double>(p[k]));
+                hi[k] = std::max(hi[k], static_cast<double>(p[k]));
+                d += (static_cast<double>(p[k]) - p0[k]) * norm[k];
             }
+            dmin = std::min(dmin, d);
+            dmax = std::max(dmax, d);
         }
+        double size = std::sqrt((hi[0] - lo[0]) * (hi[0] - lo[0]) + (hi[1] - lo[1]) * (hi[1] - lo[1]) + (hi[2] - lo[2]) * (hi[2] - lo[2]));
+        if (dmax - dmin > size * planar_tolerance)
+            return false;
+
+        // every corner turns the same way and the edges change their x and y directions twice.
+        double best = 0.0;
+        unsigned xflip = 0, yflip = 0;
+        double dx0 = 0.0, dy0 = 0.0;
+        start = 0;
+        for (auto i = 0u; i < nvert; i++)
+        {
+            const float* prev = m_snap.Pos(vrts[(i + nvert - 1) % nvert]);
+            const float* curr = m_snap.Pos(vrts[i]);
+            const float* next = m_snap.Pos(vrts[(i + 1) % nvert]);
+            double ax = static_cast<double>(curr[ix]) - prev[ix];
+            double ay = static_cast<double>(curr[iy]) - prev[iy];
+            double bx = static_cast<double>(next[ix]) - curr[ix];
+            double by = static_cast<double>(next[iy]) - curr[iy];
+            double d  = ax * by - ay * bx;
+            if ((d == 0.0) || ((d > 0.0) != ccw))
+                return false;
+            if (std::abs(d) > best)
+            {
+                best  = std::abs(d);
+                start = i;
+            }
+            if (bx != 0.0)
+            {
+                if (dx0 != 0.0 && ((bx > 0.0) != (dx0 > 0.0)))
+                    xflip ++;
+                dx0 = bx;
+            }
+            if (by != 0.0)
+            {
+                if (dy0 != 0.0 && ((by > 0.0) != (dy0 > 0.0)))
+                    yflip ++;
+                dy0 = by;
+            }
+        }
+        if (xflip > 2 || yflip > 2)
+            return false;
+
+        // keyhole polygons visit a point twice.
+        m_sorted.assign(vrts, vrts + nvert);
+        std::sort(m_sorted.begin(), m_sorted.end());
+        return std::adjacent_find(m_sorted.begin(), m_sorted.end()) == m_sorted.end();
+    }
+
+    //
+    // Triangulate the vertex list by constrained Delaunay triangulation. The vertices carry the
+    // source point indices and the faces carry the in domain flag, and the triangulation and the
+    // vertex handles are kept per thread, so no maps are built per polygon.
+    //
+    LxResult ConstraintDelaunay(AxisPlane& axisPlane, std::vector<unsigned>& source, std::vector<CTriple>& tris)
+    {
+        CDT& cdt = ThreadCDT();
+        cdt.clear();
+
+        auto nvert = source.size();
+
+        m_handles.resize(nvert);
 
-        double   z_ave = 0.0;
         for (auto i = 0u; i < nvert; i++)
         {
-            point.Select(source[i]);
-            LXtFVector pos;
-            point.Pos(pos);
+            const float* pos = m_snap.Pos(source[i]);
             double x, y, z;
             axisPlane.ToPlane(pos, x, y, z);
             try
             {
-                vertex_handles.push_back(cdt.insert(CPoint(x, y)));
+                auto count = cdt.number_of_vertices();
+                m_handles[i] = cdt.insert(CPoint(x, y));
+                // points at the same position share the vertex of the first one.
+                if (cdt.number_of_vertices() > count)
+                    m_handles[i]->info() = source[i];
             }
             catch(...)
             {
                 printf("CGAL Error pos %f %f %f x %f y %f line (%d)\n", pos[0], pos[1], pos[2], x, y, __LINE__);
                 return LXe_FAILED;
             }
-            z_ave += z;
         }
 
-        // averaged z value on axis plane
-        z_ave /= static_cast<double>(source.size());
+        // Points visited twice by keyhole polygons.
+        m_sorted.assign(source.begin(), source.end());
+        std::sort(m_sorted.begin(), m_sorted.end());
 
-        // Set vertex projected positions and edge links.
+        // Set edge links.
         for (auto i = 0u; i < nvert; i++)
         {
-            LXtPointID vrt, vrt1;
-            vrt  = source[i];
-            vrt1 = source[(i + 1) % nvert];
-            point.Select(vrt);
-            point1.Select(vrt1);
-            if (MeshUtil::IsKeyholeBridge(point, point1, source))
-            {
+            auto j = (i + 1) % nvert;
+            if (m_handles[i] == m_handles[j])
+                continue;
+            if (IsKeyholeBridge(source, i))
                 continue;
-            }
-            int v1 = indices[vrt];
-            int v2 = indices[vrt1];
             try
             {
-                cdt.insert_constraint(vertex_handles[v1], vertex_handles[v2]);
+                cdt.insert_constraint(m_handles[i], m_handles[j]);
             }
             catch(...)
             {
-                printf("CGAL Error v1 (%d) v2 (%d) line (%d)\n", v1, v2, __LINE__);
+                printf("CGAL Error v1 (%u) v2 (%u) line (%d)\n", source[i], source[j], __LINE__);
                 return LXe_FAILED;
             }
         }
@@ -133,14 +346,11 @@ public:
         {
             return LXe_FAILED;
         }
-        
-        std::unordered_map<Face_handle, bool> in_domain_map;
-        boost::associative_property_map< std::unordered_map<Face_handle,bool> > in_domain(in_domain_map);
-    
+
         // Mark facets that are inside the domain bounded by the polygon
         try
         {
-            CGAL::mark_domain_in_triangulation(cdt, in_domain);
+            CGAL::mark_domain_in_triangulation(cdt);
         }
         catch(...)
         {
@@ -148,103 +358,301 @@ public:
             return LXe_FAILED;
         }
 
-        std::vector<LXtPointID> vert(3);
-
         tris.clear();
 
-        // Make a map to get index from vertex handle.
-        std::unordered_map<Vertex_handle,int> vertex_to_index;
-        int index = 0;
-        for (auto vertex = cdt.finite_vertices_begin(); vertex != cdt.finite_vertices_end(); vertex++)
-        {
-            vertex_to_index[vertex] = index++;
-        }
-        assert(static_cast<size_t>(index) == source.size());
-
-        // Make triangle face polygons into the edit mesh.
         for (auto face = cdt.finite_faces_begin(); face != cdt.finite_faces_end(); face++)
         {
             // Skip if the face is not in domain.
-            if (!get(in_domain,face))
+            if (!face->is_in_domain())
                 continue;
 
-            // Get three vertices of the triangle
-            for (auto i = 0; i < 3; i++)
-            {
-                Vertex_handle vh = face->vertex(i);
-                index = vertex_to_index[vh];
-                vert[i] = source[index];
-            }
             // Store a new triangle vertices
-            tris.push_back(vert);
+            tris.push_back({face->vertex(0)->info(), face->vertex(1)->info(), face->vertex(2)->info()});
         }
 
         return LXe_OK;
     }
 
+    // Triangulation reused by the polygons triangulated on this thread.
+    static CDT& ThreadCDT()
+    {
+        thread_local CDT cdt;
+        return cdt;
+    }
+
+    //
     // Triangulate the polygon by ear clipping method.
-    // This method is known as ear clipping and sometimes ear trimming. An efficient algorithm for 
+    // This method is known as ear clipping and sometimes ear trimming. An efficient algorithm for
     // cutting off ears was discovered by Hossam ElGindy, Hazel Everett, and Godfried Toussaint.
-    LxResult EarClipping(AxisPlane& axisPlane, std::vector<LXtPointID>& source, std::vector<std::vector<LXtPointID>>& tris)
+    // The points are projected on the axis plane once and kept in a doubly linked ring. Only
+    // reflex vertices can be inside an ear, so they are put in a uniform grid for the ear tests,
+    // and after an ear is clipped only its two neighbors are tested again.
+    //
+    LxResult EarClipping(AxisPlane& axisPlane, std::vector<unsigned>& source, std::vector<CTriple>& tris)
     {
-        if (source.size() < 3)
+        auto n = static_cast<unsigned>(source.size());
+        if (n < 3)
             return LXe_FAILED;
 
-        if (source.size() == 3)
+        if (n == 3)
         {
-            tris.push_back(source);
+            tris.push_back({source[0], source[1], source[2]});
             return LXe_OK;
         }
 
-        CLxUser_Point point, point1;
-        point.fromMesh(m_mesh);
-        point1.fromMesh(m_mesh);
+        // Project the points. The ring is made counter clockwise by mirroring y, so the triangles
+        // keep the order of the source vertices.
+        m_xy.resize(n * 2);
+        for (auto i = 0u; i < n; i++)
+        {
+            double z;
+            axisPlane.ToPlane(m_snap.Pos(source[i]), m_xy[i * 2], m_xy[i * 2 + 1], z);
+        }
+        double area = 0.0;
+        for (auto i = 0u; i < n; i++)
+        {
+            auto j = (i + 1) % n;
+            area += m_xy[i * 2] * m_xy[j * 2 + 1] - m_xy[j * 2] * m_xy[i * 2 + 1];
+        }
+        if (area < 0.0)
+        {
+            for (auto i = 0u; i < n; i++)
+                m_xy[i * 2 + 1] = -m_xy[i * 2 + 1];
+        }
 
-        auto orient = MeshUtil::VertexListOrientation(m_mesh, axisPlane, source);
-        LXtVector n0, n1;
-        MeshUtil::TriangleNormal(m_mesh, source.back(), source.front(), source[1], n0);
-        bool flip = false;
-        bool done = false;
+        m_prev.resize(n);
+        m_next.resize(n);
+        m_state.assign(n, 0);
+        for (auto i = 0u; i < n; i++)
+        {
+            m_prev[i] = (i + n - 1) % n;
+            m_next[i] = (i + 1) % n;
+            if (Cross(m_prev[i], i, m_next[i]) <= 0.0)
+                m_state[i] |= sReflex;
+        }
 
-        std::vector<LXtPointID> verts = source;
+        MakeReflexGrid(n);
 
-        while (verts.size() > 3)
+        m_stack.clear();
+        for (auto i = n; i > 0; i--)
         {
-            LXtPointID vp = verts.back();
-            LXtPointID vc = verts.front();
-            LXtPointID vn = verts[1];
-            auto index = 0u;
-            for (auto i = 0u; i < verts.size(); i++)
+            m_stack.push_back(i - 1);
+            m_state[i - 1] |= sQueued;
+        }
+
+        auto remain   = n;
+        auto last     = 0u;
+        bool progress = false;
+        while (remain > 3)
+        {
+            if (m_stack.empty())
             {
-                vn = vp;
-                vp = vc;
-                vc = verts[(i + 1) % verts.size()];
-                if (MeshUtil::TriangleOriented(m_mesh, axisPlane, verts, orient, vn, vp, vc))
+                // Ears blocked by reflex vertices, which are gone now, are not queued again
+                // by their neighbors, so test all of the remaining vertices once more.
+                if (!progress)
+                    return LXe_FAILED;
+                progress = false;
+                auto v = last;
+                for (auto k = 0u; k < remain; k++, v = m_next[v])
                 {
-                    index = i;
-                    break;
+                    m_stack.push_back(v);
+                    m_state[v] |= sQueued;
                 }
             }
-            if (!done)
+
+            auto i = m_stack.back();
+            m_stack.pop_back();
+            m_state[i] &= ~sQueued;
+            if ((m_state[i] & sRemoved) || !IsEar(i))
+                continue;
+
+            auto p = m_prev[i];
+            auto q = m_next[i];
+            tris.push_back({source[p], source[i], source[q]});
+
+            m_next[p]   = q;
+            m_prev[q]   = p;
+            m_state[i] |= sRemoved;
+            remain --;
+            last     = q;
+            progress = true;
+
+            // Reflex vertices only turn convex while ears are clipped.
+            for (auto v : {p, q})
             {
-                MeshUtil::TriangleNormal(m_mesh, vp, vc, vn, n1);
-                flip = (LXx_VDOT(n0, n1) < 0.0);
-                done = true;
+                if ((m_state[v] & sReflex) && (Cross(m_prev[v], v, m_next[v]) > 0.0))
+                    m_state[v] &= ~sReflex;
+                if (!(m_state[v] & sQueued))
+                {
+                    m_stack.push_back(v);
+                    m_state[v] |= sQueued;
+                }
             }
-            if (flip)
-                tris.push_back({vp, vn, vc});
-            else
-                tris.push_back({vp, vc, vn});
-
-            verts.erase(verts.begin() + index);
         }
-        if (flip)
-            tris.push_back({verts[0], verts[2], verts[1]});
-        else
-            tris.push_back({verts[0], verts[1], verts[2]});
+        tris.push_back({source[m_prev[last]], source[last], source[m_next[last]]});
 
         return LXe_OK;
     }
 
-    CLxUser_Mesh m_mesh;
-};
\ No newline at end of file
+    // Cross product of (b - a) and (c - b) on the projected points.
+    double Cross(unsigned a, unsigned b, unsigned c) const
+    {
+        return (m_xy[b * 2] - m_xy[a * 2]) * (m_xy[c * 2 + 1] - m_xy[b * 2 + 1]) -
+               (m_xy[b * 2 + 1] - m_xy[a * 2 + 1]) * (m_xy[c * 2] - m_xy[b * 2]);
+    }
+
+    // Put the reflex vertices in a uniform grid of about one vertex per cell.
+    void MakeReflexGrid(unsigned n)
+    {
+        unsigned nreflex = 0;
+        m_grid_lo[0] = m_grid_lo[1] = 0.0;
+        double hi[2] = {0.0, 0.0};
+        for (auto i = 0u; i < n; i++)
+        {
+            if (!(m_state[i] & sReflex))
+                continue;
+            for (auto k = 0u; k < 2; k++)
+            {
+                double v = m_xy[i * 2 + k];
+                m_grid_lo[k] = nreflex ? std::min(m_grid_lo[k], v) : v;
+                hi[k]        = nreflex ? std::max(hi[k], v) : v;
+            }
+            nreflex ++;
+        }
+
+        m_grid_n = std::max(1u, static_cast<unsigned>(std::sqrt(static_cast<double>(nreflex))));
+        for (auto k = 0u; k < 2; k++)
+            m_grid_scale[k] = (hi[k] > m_grid_lo[k]) ? m_grid_n / (hi[k] - m_grid_lo[k]) : 0.0;
+
+        m_cell_offset.assign(m_grid_n * m_grid_n + 1, 0);
+        for (auto i = 0u; i < n; i++)
+        {
+            if (m_state[i] & sReflex)
+                m_cell_offset[Cell(m_xy[i * 2], m_xy[i * 2 + 1]) + 1] ++;
+        }
+        for (auto c = 0u; c < m_grid_n * m_grid_n; c++)
+            m_cell_offset[c + 1] += m_cell_offset[c];
+
+        m_cell.resize(nreflex);
+        m_fill.assign(m_cell_offset.begin(), m_cell_offset.end() - 1);
+        for (auto i = 0u; i < n; i++)
+        {
+            if (m_state[i] & sReflex)
+                m_cell[m_fill[Cell(m_xy[i * 2], m_xy[i * 2 + 1])] ++] = i;
+        }
+    }
+
+    unsigned CellCoord(double v, unsigned k) const
+    {
+        double c = (v - m_grid_lo[k]) * m_grid_scale[k];
+        if (c <= 0.0)
+            return 0;
+        return std::min(m_grid_n - 1, static_cast<unsigned>(c));
+    }
+
+    unsigned Cell(double x, double y) const
+    {
+        return CellCoord(y, 1) * m_grid_n + CellCoord(x, 0);
+    }
+
+    // Return true if the vertex is convex and no reflex vertex is in the triangle of the ear.
+    bool IsEar(unsigned i) const
+    {
+        auto a = m_prev[i];
+        auto c = m_next[i];
+        if (Cross(a, i, c) <= 0.0)
+            return false;
+
+        const double* pa = &m_xy[a * 2];
+        const double* pb = &m_xy[i * 2];
+        const double* pc = &m_xy[c * 2];
+        auto same = [](const double* p, const double* q) { return p[0] == q[0] && p[1] == q[1]; };
+
+        unsigned x0 = CellCoord(std::min({pa[0], pb[0], pc[0]}), 0);
+        unsigned x1 = CellCoord(std::max({pa[0], pb[0], pc[0]}), 0);
+        unsigned y0 = CellCoord(std::min({pa[1], pb[1], pc[1]}), 1);
+        unsigned y1 = CellCoord(std::max({pa[1], pb[1], pc[1]}), 1);
+        for (auto y = y0; y <= y1; y++)
+        {
+            for (auto x = x0; x <= x1; x++)
+            {
+                auto cell = y * m_grid_n + x;
+                for (auto k = m_cell_offset[cell]; k < m_cell_offset[cell + 1]; k++)
+                {
+                    auto r = m_cell[k];
+                    if ((m_state[r] & (sReflex | sRemoved)) != sReflex || r == a || r == i || r == c)
+                        continue;
+                    // keyhole points at the corners of the ear
+                    const double* pr = &m_xy[r * 2];
+                    if (same(pr, pa) || same(pr, pb) || same(pr, pc))
+                        continue;
+                    if (Cross(a, i, r) >= 0.0 && Cross(i, c, r) >= 0.0 && Cross(c, a, r) >= 0.0)
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Return true if the edge from the i-th vertex is a keyhole bridge, which is visited twice.
+    bool IsKeyholeBridge(const std::vector<unsigned>& source, unsigned i) const
+    {
+        auto n = source.size();
+        auto a = source[i];
+        auto b = source[(i + 1) % n];
+        auto twice = [&](unsigned p) {
+            auto range = std::equal_range(m_sorted.begin(), m_sorted.end(), p);
+            return (range.second - range.first) > 1;
+        };
+        if (!twice(a) || !twice(b))
+            return false;
+
+        unsigned count = 0;
+        for (auto k = 0u; k < n; k++)
+        {
+            auto c = source[k];
+            auto d = source[(k + 1) % n];
+            if ((c == a && d == b) || (c == b && d == a))
+                count ++;
+        }
+        return count == 2;
+    }
+
+    // Get the orientation of the given vertex list on the axis plane.
+    bool Orientation(AxisPlane& axisPlane, const unsigned* points, unsigned npoints) const
+    {
+        double x0, y0, x1, y1, z;
+
+        axisPlane.ToPlane(m_snap.Pos(points[0]), x0, y0, z);
+        axisPlane.ToPlane(m_snap.Pos(points[npoints - 1]), x1, y1, z);
+        double area = x1 * y0 - x0 * y1;
+
+        for (auto i = 1u; i < npoints; i++)
+        {
+            axisPlane.ToPlane(m_snap.Pos(points[i]), x1, y1, z);
+            area += x0 * y1 - x1 * y0;
+            x0 = x1;
+            y0 = y1;
+        }
+        return (area >= 0.0);
+    }
+
+    const CMeshSnapshot&       m_snap;
+    std::vector<unsigned>      m_points;     // fixed vertex list of the polygon
+    std::vector<unsigned>      m_sorted;     // sorted source points to find keyhole bridges
+    std::vector<Vertex_handle> m_handles;    // triangulation vertices of the source points
+    CTriangulateStats          m_stats;      // polygons triangulated by each path
+
+    // ear clipping
+    static constexpr uint8_t sReflex  = 0x01;
+    static constexpr uint8_t sRemoved = 0x02;
+    static constexpr uint8_t sQueued  = 0x04;
+
+    std::vector<double>        m_xy;         // points on the axis plane
+    std::vector<unsigned>      m_prev, m_next;
+    std::vector<uint8_t>       m_state;      // sReflex, sRemoved, sQueued
+    std::vector<unsigned>      m_stack;      // vertices to test as ears
+    std::vector<unsigned>      m_cell_offset, m_cell, m_fill;
+    double                     m_grid_lo[2], m_grid_scale[2];
+    unsigned                   m_grid_n;
+};
@@ -19,6 +19,7 @@
 #include <vector>
 #include <unordered_set>
 #include <tuple>
+#include <cstdint>
 
 //
 // Basic vector math functions.
@@ -905,11 +906,9 @@ static void MakeKeyhole(CLxUser_Mesh& mesh, AxisPlane& axisPlane, std::vector<LX
     }
     mark_used = s_mesh.SetMode(LXsMARK_USER_1);
 
-    printf("MakeKeyhole outer.size() = %lu holes = %lu\n", outer.size(), holes.size());
     for (auto& hole : holes)
     {
         MakePositionVectors(mesh, axisPlane, keyhole, outer_vectors);
-        printf("-- hole.size() = %lu\n", hole.size());
         std::vector<CLxVector> hole_vectors;
         MakePositionVectors(mesh, axisPlane, hole, hole_vectors);
         double min_dist = std::numeric_limits<double>::max();
@@ -956,7 +955,6 @@ static void MakeKeyhole(CLxUser_Mesh& mesh, AxisPlane& axisPlane, std::vector<LX
         }
         keyhole = temp;
     }
-    printf("** keyhole.size() = %lu\n", keyhole.size());
 }
 
 //
@@ -1344,6 +1342,19 @@ static bool TriangleOriented (CLxUser_Mesh& mesh, AxisPlane& axisPlane, std::vec
 	return true;
 }
 
+//
+// splitmix64 finalizer. Spread the bits of the key for seeds, hashed colors and hash slots.
+//
+static uint64_t Mix64 (uint64_t key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ull;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebull;
+    key ^= key >> 31;
+    return key;
+}
+
 static LxResult NewMesh (CLxUser_Mesh& new_mesh)
 {
     CLxUser_ChannelWrite    chanWrite;